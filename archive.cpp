@@ -0,0 +1,292 @@
+/*
+ * archive.cpp
+ *
+ * \date 16/10/2026
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * Binary columnar archive of the exported flows. The file starts with a header of ARCHIVE_ALIGN bytes,
+ * followed by blocks of ARCHIVE_BLOCK_SIZE bytes. Each block has a summary of its flows (number, time
+ * range, ranges of ports and protocols and a bloom filter of the addresses), so the blocks that can't
+ * match a query are skipped, followed by one column for each field. The exporters fill the blocks in
+ * memory and a dedicated thread writes them with large aligned writes, so the exporters wait for the
+ * disk only when it is slower than them.
+ */
+
+#include "archive.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <algorithm>
+
+/**
+ * Writes a buffer in a file, also if write() writes only a part of it.
+ * \param fd The file.
+ * \param buf The buffer.
+ * \param len The length of the buffer.
+ * \return False if an error occurred.
+ */
+static bool writeAll(int fd, const u_char* buf, size_t len){
+    while(len>0){
+        ssize_t r=::write(fd,buf,len);
+        if(r<0){
+            if(errno==EINTR) continue;
+            return false;
+        }
+        buf+=r;
+        len-=r;
+    }
+    return true;
+}
+
+/**
+ * Creates a queue of blocks. The FastFlow buffers must be aligned to a cache line.
+ * \return The queue (it must be destroyed with deleteQueue).
+ */
+static ff::SWSR_Ptr_Buffer* newQueue(){
+    void* m=getAlignedMemory(128,sizeof(ff::SWSR_Ptr_Buffer));
+    if(m==NULL){
+        fprintf(stderr,"Impossible to allocate the archive.\n");
+        exit(-1);
+    }
+    ff::SWSR_Ptr_Buffer* q=new (m) ff::SWSR_Ptr_Buffer(ARCHIVE_BLOCKS);
+    q->init();
+    return q;
+}
+
+/**
+ * Destroys a queue created by newQueue.
+ * \param q The queue.
+ */
+static void deleteQueue(ff::SWSR_Ptr_Buffer* q){
+    q->~SWSR_Ptr_Buffer();
+    freeAlignedMemory(q);
+}
+
+/**
+ * Creates an archive and starts its writer thread.
+ * \param path The file of the archive (it is truncated if it exists).
+ * \param producers Number of exporters that add flows to the archive.
+ */
+FlowArchive::FlowArchive(const char* path, uint producers):producers(producers),closing(false){
+    fd=open(path,O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if(fd<0){
+        perror("Impossible to open the archive");
+        exit(-1);
+    }
+    u_char *first;
+    if(posix_memalign((void**)&first,ARCHIVE_ALIGN,ARCHIVE_ALIGN)){
+        fprintf(stderr,"Impossible to allocate the archive.\n");
+        exit(-1);
+    }
+    memset(first,0,ARCHIVE_ALIGN);
+    memset(&layout,0,sizeof(layout));
+    layout.magic=ARCHIVE_MAGIC;
+    layout.version=ARCHIVE_VERSION;
+    layout.columns=ARCHIVE_COLUMNS;
+    layout.blockSize=ARCHIVE_BLOCK_SIZE;
+    layout.headerSize=ARCHIVE_ALIGN;
+    layout.created=time(NULL);
+    layout.bloomBits=ARCHIVE_BLOOM_BITS;
+    layout.bloomHashes=ARCHIVE_BLOOM_HASHES;
+    archiveLayout(layout);
+    memcpy(first,&layout,sizeof(layout));
+    if(!writeAll(fd,first,ARCHIVE_ALIGN)){
+        perror("Impossible to write the archive");
+        exit(-1);
+    }
+    free(first);
+
+    current=new u_char*[producers];
+    sequence=new u_int32_t[producers];
+    full=new ff::SWSR_Ptr_Buffer*[producers];
+    empty=new ff::SWSR_Ptr_Buffer*[producers];
+    for(uint p=0; p<producers; p++){
+        current[p]=NULL;
+        sequence[p]=0;
+        full[p]=newQueue();
+        empty[p]=newQueue();
+        for(uint i=0; i<ARCHIVE_BLOCKS; i++){
+            void* b;
+            if(posix_memalign(&b,ARCHIVE_ALIGN,ARCHIVE_BLOCK_SIZE)){
+                fprintf(stderr,"Impossible to allocate the archive.\n");
+                exit(-1);
+            }
+            empty[p]->push(b);
+        }
+    }
+    /**The writer thread doesn't handle the signals (they are handled by the reader and by the exporter).**/
+    sigset_t set,old;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK,&set,&old);
+    if(pthread_create(&writer,NULL,write,this)){
+        fprintf(stderr,"Impossible to start the writer of the archive.\n");
+        exit(-1);
+    }
+    pthread_sigmask(SIG_SETMASK,&old,NULL);
+}
+
+/**
+ * Writes the blocks given by the exporters, stops the writer thread and closes the file. The flows in
+ * blocks not given (see flush) are lost.
+ */
+FlowArchive::~FlowArchive(){
+    closing.store(true,std::memory_order_release);
+    pthread_join(writer,NULL);
+    close(fd);
+    void* b;
+    for(uint p=0; p<producers; p++){
+        if(current[p]) free(current[p]);
+        while(empty[p]->pop(&b)) free(b);
+        deleteQueue(full[p]);
+        deleteQueue(empty[p]);
+    }
+    delete[] current;
+    delete[] sequence;
+    delete[] full;
+    delete[] empty;
+}
+
+/**
+ * Body of the writer thread.
+ * \param a The archive.
+ */
+void* FlowArchive::write(void* a){
+    FlowArchive *ar=(FlowArchive*) a;
+    void* b;
+    bool error=false;
+    while(true){
+        /**Read before the queues, so the blocks given before the end are written.**/
+        bool end=ar->closing.load(std::memory_order_acquire);
+        bool found=false;
+        for(uint p=0; p<ar->producers; p++){
+            while(ar->full[p]->pop(&b)){
+                found=true;
+                if(!error && !writeAll(ar->fd,(u_char*) b,ARCHIVE_BLOCK_SIZE)){
+                    perror("Impossible to write the archive");
+                    error=true;
+                }
+                ar->empty[p]->push(b);
+            }
+        }
+        if(end) break;
+        if(!found) usleep(ARCHIVE_IDLE_WAIT);
+    }
+    return NULL;
+}
+
+/**
+ * Gives the block being filled by an exporter to the writer thread.
+ * \param p The exporter.
+ */
+void FlowArchive::hand(uint p){
+    archiveBlockHeader *h=(archiveBlockHeader*) current[p];
+    /**The unused part of the columns is cleared, so the file doesn't contain garbage.**/
+    for(uint c=0; c<ARCHIVE_COLUMNS; c++)
+        memset(current[p]+layout.columnOffset[c]+h->count*archiveColumnWidth[c],0,
+               (layout.blockRecords-h->count)*archiveColumnWidth[c]);
+    while(!full[p]->push(current[p]));
+    current[p]=NULL;
+}
+
+/**
+ * Adds a flow to the archive. A block is given to the writer thread when it is full.
+ * \param p The exporter (called only by its thread).
+ * \param f The flow.
+ */
+void FlowArchive::add(uint p, const hashElement& f){
+    archiveBlockHeader *h;
+    u_char *b=current[p];
+    if(b==NULL){
+        /**If the disk is slower than the exporter, the exporter waits for the writer.**/
+        while(!empty[p]->pop((void**) &current[p]));
+        b=current[p];
+        /**Clears the header and the bloom filter.**/
+        memset(b,0,ARCHIVE_COLUMNS_OFFSET);
+        h=(archiveBlockHeader*) b;
+        h->magic=ARCHIVE_BLOCK_MAGIC;
+        h->minFirst=~(u_int64_t)0;
+        h->minSrcPort=h->minDstPort=0xffff;
+        h->minProt=0xff;
+        h->producer=p;
+        h->sequence=sequence[p]++;
+    }else
+        h=(archiveBlockHeader*) b;
+    uint i=h->count;
+    u_int8_t *src=column<u_int8_t>(b,COL_SRCADDR)+16*i,
+             *dst=column<u_int8_t>(b,COL_DSTADDR)+16*i;
+    if(f.ipVersion==6){
+        in6_addr a;
+        getSrcAddr6(f,&a);
+        memcpy(src,&a,16);
+        getDstAddr6(f,&a);
+        memcpy(dst,&a,16);
+    }else{
+        memset(src,0,16);
+        memcpy(src,&f.srcaddr,4);
+        memset(dst,0,16);
+        memcpy(dst,&f.dstaddr,4);
+    }
+    u_int64_t first=(u_int64_t)f.First.tv_sec*1000+f.First.tv_usec/1000,
+              last=(u_int64_t)f.Last.tv_sec*1000+f.Last.tv_usec/1000;
+    u_int16_t srcport=ntohs(f.srcport),dstport=ntohs(f.dstport);
+    column<u_int64_t>(b,COL_FIRST)[i]=first;
+    column<u_int64_t>(b,COL_LAST)[i]=last;
+    column<u_int32_t>(b,COL_DPKTS)[i]=f.dPkts;
+    column<u_int32_t>(b,COL_DOCTETS)[i]=f.dOctets;
+    column<u_int32_t>(b,COL_TUNNELID)[i]=f.tunnelId;
+    column<u_int16_t>(b,COL_SRCPORT)[i]=srcport;
+    column<u_int16_t>(b,COL_DSTPORT)[i]=dstport;
+    column<u_int16_t>(b,COL_VLANID)[i]=f.vlanId;
+    column<u_int8_t>(b,COL_TCPFLAGS)[i]=f.tcp_flags;
+    column<u_int8_t>(b,COL_PROT)[i]=f.prot;
+    column<u_int8_t>(b,COL_TOS)[i]=f.tos;
+    column<u_int8_t>(b,COL_IPVERSION)[i]=f.ipVersion;
+    /**Summary of the block.**/
+    h->minFirst=std::min(h->minFirst,first);
+    h->maxLast=std::max(h->maxLast,last);
+    h->minSrcPort=std::min(h->minSrcPort,srcport);
+    h->maxSrcPort=std::max(h->maxSrcPort,srcport);
+    h->minDstPort=std::min(h->minDstPort,dstport);
+    h->maxDstPort=std::max(h->maxDstPort,dstport);
+    h->minProt=std::min(h->minProt,f.prot);
+    h->maxProt=std::max(h->maxProt,f.prot);
+    u_int8_t *bloom=b+ARCHIVE_BLOOM_OFFSET;
+    u_int64_t hs=archiveHash(src),hd=archiveHash(dst);
+    for(uint k=0; k<ARCHIVE_BLOOM_HASHES; k++){
+        u_int32_t bs=archiveBloomBit(hs,k),bd=archiveBloomBit(hd,k);
+        bloom[bs>>3]|=1<<(bs&7);
+        bloom[bd>>3]|=1<<(bd&7);
+    }
+    if(++h->count==layout.blockRecords)
+        hand(p);
+}
+
+/**
+ * Gives the block being filled by an exporter to the writer thread, also if not full.
+ * \param p The exporter (called only by its thread).
+ */
+void FlowArchive::flush(uint p){
+    if(current[p]!=NULL)
+        hand(p);
+}
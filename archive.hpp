@@ -0,0 +1,220 @@
+/*
+ * archive.hpp
+ *
+ * \date 16/10/2026
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * Binary columnar archive of the exported flows. The file starts with a header of ARCHIVE_ALIGN bytes,
+ * followed by blocks of ARCHIVE_BLOCK_SIZE bytes. Each block has a summary of its flows (number, time
+ * range, ranges of ports and protocols and a bloom filter of the addresses), so the blocks that can't
+ * match a query are skipped, followed by one column for each field. The exporters fill the blocks in
+ * memory and a dedicated thread writes them with large aligned writes, so the exporters wait for the
+ * disk only when it is slower than them.
+ */
+
+#ifndef ARCHIVE_HPP_
+#define ARCHIVE_HPP_
+#include <pthread.h>
+#include <atomic>
+#include <ff/buffer.hpp>
+#include "flow.hpp"
+
+#define ARCHIVE_MAGIC 0x41504646 ///<"FFPA" (little endian), first bytes of an archive.
+#define ARCHIVE_BLOCK_MAGIC 0x42504646 ///<"FFPB" (little endian), first bytes of a block.
+#define ARCHIVE_VERSION 2 ///<Version of the format of the archive.
+#define ARCHIVE_ALIGN 4096 ///<Alignment of the blocks in memory and in the file.
+#define ARCHIVE_BLOCK_SIZE (1024*1024) ///<Size of a block (header included).
+#define ARCHIVE_BLOCKS 16 ///<Number of blocks of each exporter (the ones being written included).
+#define ARCHIVE_IDLE_WAIT 1000 ///<Microseconds waited by the writer when there are no blocks to write.
+#define ARCHIVE_BLOOM_BITS (256*1024) ///<Bits of the bloom filter of the addresses of a block (a power of 2).
+#define ARCHIVE_BLOOM_HASHES 4 ///<Bits set in the bloom filter for each address.
+#define ARCHIVE_COLUMN_ALIGN 64 ///<Alignment of the columns in a block.
+
+/**
+ * The columns of a block. The addresses are in network byte order (an IPv4 address is in the first
+ * 4 bytes and the others are 0), the other fields in host byte order.
+ */
+enum archiveColumn{
+    COL_SRCADDR,   ///<16 bytes.
+    COL_DSTADDR,   ///<16 bytes.
+    COL_FIRST,     ///<Start time (u_int64_t, milliseconds since 0000 UTC 1970).
+    COL_LAST,      ///<End time (u_int64_t, milliseconds since 0000 UTC 1970).
+    COL_DPKTS,     ///<u_int32_t.
+    COL_DOCTETS,   ///<u_int32_t.
+    COL_TUNNELID,  ///<u_int32_t.
+    COL_SRCPORT,   ///<u_int16_t.
+    COL_DSTPORT,   ///<u_int16_t.
+    COL_VLANID,    ///<u_int16_t.
+    COL_TCPFLAGS,  ///<u_int8_t.
+    COL_PROT,      ///<u_int8_t.
+    COL_TOS,       ///<u_int8_t.
+    COL_IPVERSION, ///<u_int8_t.
+    ARCHIVE_COLUMNS
+};
+
+/**
+ * Width of the values of each column.
+ */
+static const u_int8_t archiveColumnWidth[ARCHIVE_COLUMNS]={16,16,8,8,4,4,4,2,2,2,1,1,1,1};
+
+/**
+ * Header of an archive.
+ */
+struct archiveHeader{
+    u_int32_t magic;       ///<ARCHIVE_MAGIC.
+    u_int16_t version;     ///<ARCHIVE_VERSION.
+    u_int16_t columns;     ///<ARCHIVE_COLUMNS.
+    u_int32_t blockSize;   ///<Size of a block.
+    u_int32_t headerSize;  ///<Offset of the first block.
+    u_int64_t created;     ///<Creation time of the archive (seconds since 0000 UTC 1970).
+    u_int32_t blockRecords; ///<Maximum number of flows in a block.
+    u_int32_t bloomBits;   ///<ARCHIVE_BLOOM_BITS.
+    u_int32_t bloomHashes; ///<ARCHIVE_BLOOM_HASHES.
+    u_int32_t columnOffset[ARCHIVE_COLUMNS]; ///<Offset of each column in a block.
+    u_int8_t columnWidth[ARCHIVE_COLUMNS];   ///<archiveColumnWidth.
+};
+
+/**
+ * Header of a block, followed by the bloom filter of the addresses and by the columns.
+ */
+struct archiveBlockHeader{
+    u_int32_t magic;       ///<ARCHIVE_BLOCK_MAGIC.
+    u_int32_t count;       ///<Number of flows in the block.
+    u_int64_t minFirst;    ///<Smallest start time of the flows (milliseconds since 0000 UTC 1970).
+    u_int64_t maxLast;     ///<Largest end time of the flows (milliseconds since 0000 UTC 1970).
+    u_int32_t producer;    ///<The exporter that filled the block.
+    u_int32_t sequence;    ///<Number of blocks filled by the exporter before this one.
+    u_int16_t minSrcPort, maxSrcPort, minDstPort, maxDstPort; ///<Ranges of the ports of the flows.
+    u_int8_t minProt, maxProt; ///<Range of the protocols of the flows.
+    u_int8_t pad[22];
+};
+
+#define ARCHIVE_BLOOM_OFFSET sizeof(archiveBlockHeader) ///<Offset of the bloom filter in a block.
+#define ARCHIVE_COLUMNS_OFFSET (ARCHIVE_BLOOM_OFFSET+ARCHIVE_BLOOM_BITS/8) ///<Offset of the first column in a block.
+
+/**
+ * Fills the layout of the blocks in the header of an archive (number of flows and offsets of the columns).
+ * The number of flows is a multiple of ARCHIVE_COLUMN_ALIGN, so all the columns are aligned.
+ * \param h The header.
+ */
+inline void archiveLayout(archiveHeader& h){
+    uint row=0;
+    for(uint c=0; c<ARCHIVE_COLUMNS; c++)
+        row+=archiveColumnWidth[c];
+    h.blockRecords=((ARCHIVE_BLOCK_SIZE-ARCHIVE_COLUMNS_OFFSET)/row)&~(ARCHIVE_COLUMN_ALIGN-1);
+    uint offset=ARCHIVE_COLUMNS_OFFSET;
+    for(uint c=0; c<ARCHIVE_COLUMNS; c++){
+        h.columnOffset[c]=offset;
+        h.columnWidth[c]=archiveColumnWidth[c];
+        offset+=h.blockRecords*archiveColumnWidth[c];
+    }
+}
+
+/**
+ * Hashes an address for the bloom filter. The hash doesn't depend on the CPU, so the archives
+ * can be read on other machines.
+ * \param a The address (16 bytes).
+ * \return The hash.
+ */
+inline u_int64_t archiveHash(const u_int8_t* a){
+    u_int64_t x,y;
+    memcpy(&x,a,8);
+    memcpy(&y,a+8,8);
+    x=(x*0x9E3779B97F4A7C15ULL)^(y*0xC2B2AE3D27D4EB4FULL);
+    x^=x>>29;
+    x*=0xBF58476D1CE4E5B9ULL;
+    return x^(x>>32);
+}
+
+/**
+ * Returns the i-th bit of the bloom filter of an address (double hashing).
+ * \param h The hash of the address.
+ * \param i The index of the bit (less than ARCHIVE_BLOOM_HASHES).
+ */
+inline u_int32_t archiveBloomBit(u_int64_t h, uint i){
+    return ((u_int32_t)h+i*((u_int32_t)(h>>32)|1))&(ARCHIVE_BLOOM_BITS-1);
+}
+
+/**
+ * Writes the flows of one or more exporters in an archive. Each exporter (producer) has its own blocks,
+ * given to the writer thread and returned by it through lock-free single producer/single consumer queues.
+ */
+class FlowArchive{
+private:
+    int fd; ///<The file.
+    uint producers; ///<Number of exporters.
+    u_char **current; ///<The block being filled by each exporter (NULL if none).
+    u_int32_t *sequence; ///<Number of blocks filled by each exporter.
+    archiveHeader layout; ///<The layout of the blocks.
+    ff::SWSR_Ptr_Buffer **full, ///<The blocks filled by each exporter, to be written.
+                        **empty; ///<The blocks of each exporter already written.
+    std::atomic<bool> closing; ///<True when the exporters have terminated.
+    pthread_t writer; ///<The writer thread.
+
+    /**
+     * Body of the writer thread.
+     * \param a The archive.
+     */
+    static void* write(void* a);
+
+    /**
+     * Gives the block being filled by an exporter to the writer thread.
+     * \param p The exporter.
+     */
+    void hand(uint p);
+
+    /**
+     * Returns a column of a block.
+     * \param b The block.
+     * \param c The column.
+     */
+    template<typename T> inline T* column(u_char* b, archiveColumn c){return (T*) (b+layout.columnOffset[c]);}
+public:
+    /**
+     * Creates an archive and starts its writer thread.
+     * \param path The file of the archive (it is truncated if it exists).
+     * \param producers Number of exporters that add flows to the archive.
+     */
+    FlowArchive(const char* path, uint producers);
+
+    /**
+     * Writes the blocks given by the exporters, stops the writer thread and closes the file. The flows in
+     * blocks not given (see flush) are lost.
+     */
+    ~FlowArchive();
+
+    /**
+     * Adds a flow to the archive. A block is given to the writer thread when it is full.
+     * \param p The exporter (called only by its thread).
+     * \param f The flow.
+     */
+    void add(uint p, const hashElement& f);
+
+    /**
+     * Gives the block being filled by an exporter to the writer thread, also if not full.
+     * \param p The exporter (called only by its thread).
+     */
+    void flush(uint p);
+};
+
+#endif /* ARCHIVE_HPP_ */
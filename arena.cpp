@@ -0,0 +1,136 @@
+/*
+ * arena.cpp
+ *
+ * \date 16/10/2026
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * Memory used to store the flows. It is allocated once (optionally on huge pages,
+ * populated and locked in RAM) and reused through free lists, so the workers don't
+ * call malloc and free while they update the flows.
+ */
+
+#include "arena.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+bool useHugePages=false;
+
+/**
+ * Constructor of the arena. If useHugePages is true the memory is allocated on huge pages (on normal
+ * pages if there are not enough free huge pages), populated and locked in RAM. Otherwise the pages are
+ * allocated when they are touched for the first time (and transparent huge pages are requested).
+ * \param size Size of the arena.
+ */
+Arena::Arena(size_t size):base((char*)MAP_FAILED),size(size),used(0){
+    if(this->size==0) this->size=1;
+    if(useHugePages){
+        this->size=(this->size+HUGE_PAGE_SIZE-1)&~(HUGE_PAGE_SIZE-1);
+#ifdef MAP_HUGETLB
+        base=(char*)mmap(NULL,this->size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_POPULATE,-1,0);
+#endif
+    }
+    if(base==MAP_FAILED){
+        base=(char*)mmap(NULL,this->size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+        if(base==MAP_FAILED){
+            perror("Allocating the memory of the flows");
+            exit(-1);
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(base,this->size,MADV_HUGEPAGE);
+#endif
+    }
+    /**Locking the pages also populates them.**/
+    if(useHugePages && mlock(base,this->size))
+        perror("Locking the memory of the flows");
+}
+
+/**
+ * Destructor of the arena.
+ */
+Arena::~Arena(){
+    munmap(base,size);
+}
+
+/**
+ * Allocates memory from the arena (aligned to a cache line).
+ * \param bytes Number of bytes.
+ * \return The memory or NULL if the arena is exhausted.
+ */
+void* Arena::allocate(size_t bytes){
+    size_t start=(used+63)&~(size_t)63;
+    if(start+bytes>size) return NULL;
+    used=start+bytes;
+    return base+start;
+}
+
+/**
+ * Constructor of the slab.
+ * \param size Size of the arena.
+ * \param minBlock Size of the blocks of the first class (at least sizeof(void*)).
+ */
+Slab::Slab(size_t size, size_t minBlock):arena(size),minBlock(minBlock){
+    memset(freeLists,0,sizeof(freeLists));
+}
+
+/**
+ * Destructor of the slab. The blocks allocated with malloc must have been released.
+ */
+Slab::~Slab(){
+    for(uint k=0; k<SLAB_CLASSES; k++)
+        while(freeLists[k]){
+            void* b=freeLists[k];
+            freeLists[k]=*(void**)b;
+            if(!arena.contains(b)) free(b);
+        }
+}
+
+/**
+ * Gets a block.
+ * \param k The class of the block (it is minBlock<<k bytes long).
+ * \return The block (its content is undefined).
+ */
+void* Slab::get(uint k){
+    void* b=freeLists[k];
+    if(b){
+        freeLists[k]=*(void**)b;
+        return b;
+    }
+    b=arena.allocate(minBlock<<k);
+    if(b==NULL && (b=malloc(minBlock<<k))==NULL){
+        perror("Allocating the memory of the flows");
+        exit(-1);
+    }
+    return b;
+}
+
+/**
+ * Releases a block.
+ * \param b The block.
+ * \param k The class of the block.
+ */
+void Slab::put(void* b, uint k){
+    *(void**)b=freeLists[k];
+    freeLists[k]=b;
+}
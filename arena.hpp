@@ -0,0 +1,129 @@
+/*
+ * arena.hpp
+ *
+ * \date 16/10/2026
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * Memory used to store the flows. It is allocated once (optionally on huge pages,
+ * populated and locked in RAM) and reused through free lists, so the workers don't
+ * call malloc and free while they update the flows.
+ */
+
+#ifndef ARENA_HPP_
+#define ARENA_HPP_
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Size of a huge page.
+ */
+#define HUGE_PAGE_SIZE (2UL*1024*1024)
+
+/**
+ * Number of size classes of a slab (the blocks of the class k are minBlock<<k bytes long).
+ */
+#define SLAB_CLASSES 32
+
+/**
+ * If true the flows are stored on huge pages, populated and locked in RAM when they are allocated.
+ */
+extern bool useHugePages;
+
+/**
+ * A region of memory allocated with a single mmap. The memory is given with a bump pointer and is released
+ * only when the arena is destroyed.
+ */
+class Arena{
+private:
+    char *base;    ///<The memory.
+    size_t size,   ///<Size of the memory.
+           used;   ///<Bytes already given.
+public:
+    /**
+     * Constructor of the arena. If useHugePages is true the memory is allocated on huge pages (on normal
+     * pages if there are not enough free huge pages), populated and locked in RAM. Otherwise the pages are
+     * allocated when they are touched for the first time (and transparent huge pages are requested).
+     * \param size Size of the arena.
+     */
+    Arena(size_t size);
+
+    /**
+     * Destructor of the arena.
+     */
+    ~Arena();
+
+    /**
+     * Allocates memory from the arena (aligned to a cache line).
+     * \param bytes Number of bytes.
+     * \return The memory or NULL if the arena is exhausted.
+     */
+    void* allocate(size_t bytes);
+
+    /**
+     * Checks if a pointer is inside the arena.
+     * \param p The pointer.
+     */
+    inline bool contains(const void* p){
+        return (const char*)p>=base && (const char*)p<base+size;
+    }
+};
+
+/**
+ * Allocator of blocks whose sizes are minBlock multiplied by a power of two. The blocks are taken from an arena
+ * and the released ones are kept in a free list for each size, so they are reused without calling malloc.
+ * When the arena is exhausted the blocks are allocated with malloc.
+ */
+class Slab{
+private:
+    Arena arena;                      ///<The memory of the blocks.
+    size_t minBlock;                  ///<Size of the blocks of the first class.
+    void* freeLists[SLAB_CLASSES];    ///<The released blocks of each class (each one contains the pointer to the next).
+public:
+    /**
+     * Constructor of the slab.
+     * \param size Size of the arena.
+     * \param minBlock Size of the blocks of the first class (at least sizeof(void*)).
+     */
+    Slab(size_t size, size_t minBlock);
+
+    /**
+     * Destructor of the slab. The blocks allocated with malloc must have been released.
+     */
+    ~Slab();
+
+    /**
+     * Gets a block.
+     * \param k The class of the block (it is minBlock<<k bytes long).
+     * \return The block (its content is undefined).
+     */
+    void* get(uint k);
+
+    /**
+     * Releases a block.
+     * \param b The block.
+     * \param k The class of the block.
+     */
+    void put(void* b, uint k);
+};
+
+#endif /* ARENA_HPP_ */
@@ -50,44 +50,88 @@
  * \param progName The name of the program.
  */
 void printHelp(char* progName){
-fprintf(stderr,"\nusage: %s -i <captureInterface> [--sequential] [-d <idleTimeout>] [-l <lifetimeTimeout>]\n"
-        "[-q <queueTimeout>] [<-r readers>] [-w <workers>] [<-e exporters>] [-j | --cores] <cores>\n"
-        "[-u <chip>] [-s <hashSize>] [-m <maxActiveFlows>] [-x <cnt>] [-f <outputFile>] [-z <flowsPerTaskCheck>]\n"
-        "[-c | --collector] <collector> [-p | --port] <port> [-y <minFlowSize>] [-n | --nopromisc] [-h]\n\n\n", progName);
+fprintf(stderr,"\nusage: %s -i <captureInterface> [-a | --source] <source> [--sequential] [--rawslices] [--kernelparsing] [--vlankey] [--decap] [--symmetric] [-d <idleTimeout>] [-l <lifetimeTimeout>]\n"
+        "[-q <queueTimeout>] [<-r readers>] [-w <workers>] [<-e exporters>] [--farm] [-j | --cores] <cores>\n"
+        "[-u <chip>] [-t | --table] <table> [-s <hashSize>] [-m <maxActiveFlows>] [--evict <percent>] [--hugepages] [-x <cnt>] [-b <burst>] [-f <outputFile>] [--textformat <format>] [--rotate <seconds>] [--rotatesize <MB>] [--compress] [-z <flowsPerTaskCheck>]\n"
+        "[-c | --collector] <collector> [-p | --port] <port> [--format <format>] [--archive <file>] [-y <minFlowSize>] [-n | --nopromisc] [-h]\n\n\n", progName);
 fprintf(stderr,"-i <captureInterface>          | Interface name from which packets are captured. You can also specify more than one\n"
         "                               | interfaces separating them by an underscore (e.g. -i eth1_eth2_..._ethn). In this case you have also to\n"
-        "                               | specify -r n.\n");
+        "                               | specify -r n. If it is the path of a .pcap or .pcapng file, the packets are read from the file\n"
+        "                               | at full speed and the probe terminates at the end of the file.\n");
+fprintf(stderr,"[-a | --source] <source>       | It specifies how the packets are captured: pfring, pcap (libpcap), afpacket (AF_PACKET\n"
+        "                               | TPACKET_V3 ring) or file (.pcap/.pcapng file) [default file if the captureInterface is a\n"
+        "                               | regular file, pfring otherwise (afpacket if ffProbe has been compiled with PFRING=0)].\n"
+        "                               | AF_PACKET readers opening the same interface (e.g. -r 2 -i eth0_eth0) share its traffic.\n");
 fprintf(stderr,"[--sequential]                 | Executes the probe sequentially.\n");
+fprintf(stderr,"[--rawslices]                  | The reader only copies the first %d bytes of each packet and chooses the worker from the\n"
+        "                               | IP addresses. The packets are parsed by the workers in parallel.\n",RAW_SLICE);
+fprintf(stderr,"[--kernelparsing]              | Uses the fields of the packets parsed by the PF_RING kernel module and their nanosecond\n"
+        "                               | timestamps instead of parsing the packets. The packets not parsed by the kernel are parsed\n"
+        "                               | by ffProbe. Only the pfring source supports it (not with --decap).\n");
+fprintf(stderr,"[--vlankey]                    | The VLAN ID of the innermost 802.1Q tag is part of the key of the flows, so the same\n"
+        "                               | flow on different VLANs is accounted separately.\n");
+fprintf(stderr,"[--decap]                      | The flows are built from the packets carried by GRE, VXLAN, GTP-U and IP-in-IP tunnels\n"
+        "                               | and are identified also by the tunnel ID (GRE key, VNI or TEID).\n");
+fprintf(stderr,"[--symmetric]                  | The two directions of a flow have the same hash, so they are managed by the same worker.\n");
 fprintf(stderr,"[-d <idleTimeout>]             | It specifies the maximum (seconds) flow idle lifetime [default 30]\n");
 fprintf(stderr,"[-l <lifetimeTimeout>]         | It specifies the maximum (seconds) flow lifetime [default 120]\n");
-fprintf(stderr,"[-q <queueTimeout>]            | It specifies how long (seconds) expired flows (queued before delivery) are emitted [default 30]\n");
+fprintf(stderr,"[-q <queueTimeout>]            | It specifies how long (seconds) expired flows (queued before delivery) are emitted [default 30]\n"
+        "                               | The datagrams are sent %d at a time (with a single system call) or when this timeout expires.\n",EXPORT_BATCH);
 fprintf(stderr,"[-r <readers>]                 | It specifies how many reader threads read from different interfaces) [default 1].\n"
         "                               | If you want to use more than one reader you have to recompile ffProbe with -DMULTIPLE_READERS.\n");
-fprintf(stderr,"[-w <workers>]                 | It specifies how many threads manage the hash table [default 1].\n"
-        "                               | HashSize %% (workers) must be equals to 0\n");
+fprintf(stderr,"[-w <workers>]                 | It specifies how many threads manage the hash table [default 1].\n");
 fprintf(stderr,"[-e <exporters>]               | It specifies if the exporter is executed by an indipendent thread (1) or if it's executed\n"
-        "                               | by the same thread of one of the workers (0) [default 1].\n");
+        "                               | by the same thread of one of the workers (0) [default 1]. With --farm more exporters (at most\n"
+        "                               | one for each worker) can be used, each one with its own socket and NetFlow engine id. The\n"
+        "                               | worker w sends its flows to the exporter w%%exporters.\n");
+fprintf(stderr,"[--farm]                       | The reader sends the packets of each worker directly to it and the workers send the expired\n"
+        "                               | flows directly to the exporter, instead of passing the tasks along a pipeline of workers.\n"
+        "                               | It requires one reader and an indipendent exporter.\n");
 fprintf(stderr,"[-j | --cores] <cores>  | It specifies the identifiers of the cores on which the stages of the pipeline should be mapped [default 0].\n"
         "                               | The cores identifiers must be separated by an underscore (e.g. 0_1_2_3). The stages of the pipeline will be mapped\n"
         "                               | in the same order.\n");
 fprintf(stderr,"[-u <chip>]                    | It specifies the identifier of the chip on which the pipeline should be mapped [default 0].\n"
         "                               | If it is composed by a number of threads higher than the number of core on the chip the other stages\n"
         "                               | will be mapped on the successive cores.\n");
-fprintf(stderr,"[-s <hashSize>]                | It specifies the size of the hash table where the flows are stored [default 32762].\n"
-        "                               | HashSize %% (workers) must be equals to 0, moreover HashSize should not be a power of 2 because tha hash function\n"
-                "                               | is h(x)=x %% HashSize\n");
+fprintf(stderr,"[-t | --table] <table>         | It specifies how the workers store the flows: chained (a collision list for each row) or\n"
+        "                               | flat (open addressing, 16 slots compared with a single SSE2 instruction, the flows are\n"
+        "                               | expired by a timer wheel) [default flat].\n");
+fprintf(stderr,"[-s <hashSize>]                | It specifies the size of the hash table where the flows are stored [default 32768].\n"
+        "                               | The table of each worker has hashSize/workers rows, rounded up to a power of 2.\n");
 fprintf(stderr,"[-m <maxActiveFlows>]          | Limit the number of active flows for one worker. This is useful if you want to limit the\n"
         "                               | memory allocated to ffProbe [default 3000000]\n");
+fprintf(stderr,"[--evict <percent>]            | Percentage of maxActiveFlows evicted when a worker has maxActiveFlows flows (at least one).\n"
+        "                               | The flat table evicts the flows with the nearest deadlines (the least recently updated),\n"
+        "                               | the chained one the next flows checked for the expiration [default 1]\n");
+fprintf(stderr,"[--hugepages]                  | The memory of the flows is allocated at startup on 2MB huge pages and locked in RAM.\n"
+        "                               | Its size depends on maxActiveFlows, so -m should be set accordingly.\n");
 fprintf(stderr,"[-x <cnt>]                     | Cnt is the maximum number of packets to process before returning from reading, but is not a minimum\n"
         "                               | number. If less than cnt packets are present, only those packets will be processed. If no packets are presents,\n"
         "                               | read returns immediately. A  value of -1 means \"process packets until there is at least one packet on the buffer\".\n"
         "                               | This can be dangerous because if the packets rate is very high the program will always find packets in the buffer\n"
         "                               | and so can fill the memory. A value of -1 when reading a live capture causes all the packets in the file to be\n"
         "                               | processed [default 10000]\n");
+fprintf(stderr,"[-b <burst>]                   | Number of packets requested to the source with a single call (between %d and %d).\n"
+        "                               | The reader parses a whole burst before giving its flows to the workers [default %d]\n",
+        READER_MIN_BURST,READER_MAX_BURST,READER_BURST);
 fprintf(stderr,"[-f <outputFile>]              | Print the flows in textual format on a file\n");
-fprintf(stderr,"[-z <flowsPerTaskCheck>]       | Number of flows to check for expiration after the arrival of a task to a worker. (-1 is all) [default 200]\n");
+fprintf(stderr,"[--textformat <format>]        | Format of the flows printed with -f: pipe (one line for each flow, with the fields\n"
+        "                               | separated by '|') or ndjson (one JSON object for each line) [default pipe]\n");
+fprintf(stderr,"[--rotate <seconds>]           | The output file is split in segments of the specified seconds (aligned to multiples of\n"
+        "                               | them), named <outputFile>.<start time>.<n> [default no rotation]\n");
+fprintf(stderr,"[--rotatesize <MB>]            | The output file is split in segments of (about) the specified megabytes, named as\n"
+        "                               | with --rotate [default no rotation]\n");
+fprintf(stderr,"[--compress]                   | The output file (each segment) is compressed with zstd (.zst suffix) by a dedicated\n"
+        "                               | thread [default not compressed]\n");
+fprintf(stderr,"[-z <flowsPerTaskCheck>]       | Number of flows to check for expiration after the arrival of a task to a worker. (-1 is all)\n"
+        "                               | Only used by the chained table [default 200]\n");
 fprintf(stderr,"[-c | --collector] <collector> | Host of the collector [default 127.0.0.1]\n");
 fprintf(stderr,"[-p | --port] <port>           | Port of the collector [default 2055]\n");
+fprintf(stderr,"[--format <format>]            | Protocol used to send the flows to the collector: netflow5 (the IPv6 flows are sent with\n"
+        "                               | NetFlow v9), netflow9 or ipfix. The NetFlow v9 and IPFIX templates are sent every %d seconds\n"
+        "                               | [default netflow5]\n",EXPORT_TEMPLATE_TIMEOUT);
+fprintf(stderr,"[--archive <file>]             | Write the exported flows also on a binary columnar archive, made of blocks of %d bytes\n"
+        "                               | written by a dedicated thread, that can be queried with ffProbe-query\n",ARCHIVE_BLOCK_SIZE);
 fprintf(stderr,"[-y <minFlowSize>]             | Minimum TCP flow size (in bytes). If a TCP flow is shorter than the specified size the flow\n"
         "                               | is not emitted. 0 is unlimited [default unlimited]\n");
 fprintf(stderr,"[-n | --nopromisc]             | Put the interface into 'No promiscuous' mode.\n");
@@ -98,6 +142,22 @@ fprintf(stderr,"[-h]                           | Prints this help\n");
 /* An array describing valid long options.  */
 static const struct option long_options[] = {
   { "sequential",     no_argument, NULL, 0 },
+  { "rawslices",     no_argument, NULL, 0 },
+  { "kernelparsing",     no_argument, NULL, 0 },
+  { "vlankey",     no_argument, NULL, 0 },
+  { "decap",     no_argument, NULL, 0 },
+  { "symmetric",     no_argument, NULL, 0 },
+  { "evict",     required_argument, NULL, 0 },
+  { "hugepages",     no_argument, NULL, 0 },
+  { "farm",     no_argument, NULL, 0 },
+  { "format",     required_argument, NULL, 0 },
+  { "archive",     required_argument, NULL, 0 },
+  { "textformat",     required_argument, NULL, 0 },
+  { "rotate",     required_argument, NULL, 0 },
+  { "rotatesize",     required_argument, NULL, 0 },
+  { "compress",     no_argument, NULL, 0 },
+  { "source",     required_argument, NULL, 'a' },
+  { "table",     required_argument, NULL, 't' },
   { "cores",     required_argument, NULL, 'j' },
   { "nopromisc",     no_argument, NULL, 'n' },
   { "collector",     no_argument, NULL, 'c' },
@@ -106,26 +166,34 @@ static const struct option long_options[] = {
 };
 
 /**Statistics collection.**/
-extern pfring** handle;
+extern PacketSource** sources;
 extern uint numReaders;
 extern uint* plast;
 
 int main(int argc, char** argv){
   char *interface=NULL;
-    const char *collector="127.0.0.1";
+    const char *collector="127.0.0.1",*source=NULL,*table=NULL,*archivePath=NULL,*outputPath=NULL;
     int c,cnt=10000,flowsPerTaskCheck=200;
-    uint minFlowSize=0, queueTimeout=30,lifetime=120,readers=1,workers=1,indipendent_exporter=1,idle=30,maxActiveFlows=3000000u,hashSize=32762,chip=0,promisc=1;
+    uint minFlowSize=0, queueTimeout=30,lifetime=120,readers=1,workers=1,indipendent_exporter=1,idle=30,maxActiveFlows=3000000u,hashSize=32768,chip=0,promisc=1,burst=READER_BURST;
     ushort port=2055;
     uint *cores=NULL;
-    bool sequential=false;
-    FILE* output=NULL;
+    float evict=1;
+    bool sequential=false,rawSlices=false,kernelParsing=false,farm=false,compress=false;
+    uint rotateTime=0,rotateSize=0;
+    FlowOutput* output=NULL;
     /**Args parsing.**/
     int longindex;
-    while ((c = getopt_long (argc, argv, "i:d:l:q:t:r:w:e:j:u:s:m:x:f:z:c:p:y:nh", long_options, &longindex)) != -1)
+    while ((c = getopt_long (argc, argv, "i:a:d:l:q:t:r:w:e:j:u:s:m:x:b:f:z:c:p:y:nh", long_options, &longindex)) != -1)
         switch (c){
             case 'i':
                 interface = optarg;
                 break;
+            case 'a':
+                source = optarg;
+                break;
+            case 't':
+                table = optarg;
+                break;
             case 'd':
                 idle = atoi(optarg);
                 break;
@@ -152,11 +220,11 @@ int main(int argc, char** argv){
                 }
                 break;
             case 'e':
-                indipendent_exporter = atoi(optarg);
-                if(indipendent_exporter!=0 && indipendent_exporter!=1){
-                    printf("ERROR: -e [<0|1>].\n");
+                if(atoi(optarg)<0){
+                    printf("ERROR: -e [<0|1|exporters>].\n");
                     exit(-1);
                 }
+                indipendent_exporter = atoi(optarg);
                 break;
             case 'j':{
                 //TODO MANAGE SEQUENTIAL
@@ -192,10 +260,15 @@ int main(int argc, char** argv){
             case 'x':
                 cnt=atoi(optarg);
                 break;
+            case 'b':
+                burst=atoi(optarg);
+                if(burst<READER_MIN_BURST || burst>READER_MAX_BURST){
+                    printf("ERROR: -b <burst> must be between %d and %d.\n",READER_MIN_BURST,READER_MAX_BURST);
+                    exit(-1);
+                }
+                break;
             case 'f':
-                output=fopen(optarg,"w");
-                if(output==NULL)
-                    perror("Opening output file: ");
+                outputPath=optarg;
                 break;
             case 'z':
                 flowsPerTaskCheck=atoi(optarg);
@@ -221,24 +294,106 @@ int main(int argc, char** argv){
             case 0:
                 if(strcmp( "sequential", long_options[longindex].name ) == 0 )
                     sequential = true;
+                else if(strcmp( "rawslices", long_options[longindex].name ) == 0 )
+                    rawSlices = true;
+                else if(strcmp( "kernelparsing", long_options[longindex].name ) == 0 )
+                    kernelParsing = true;
+                else if(strcmp( "vlankey", long_options[longindex].name ) == 0 )
+                    vlanKeyMask = 0x0fff;
+                else if(strcmp( "decap", long_options[longindex].name ) == 0 )
+                    decapTunnels = true;
+                else if(strcmp( "symmetric", long_options[longindex].name ) == 0 )
+                    symmetricHash = true;
+                else if(strcmp( "hugepages", long_options[longindex].name ) == 0 )
+                    useHugePages = true;
+                else if(strcmp( "farm", long_options[longindex].name ) == 0 )
+                    farm = true;
+                else if(strcmp( "format", long_options[longindex].name ) == 0 ){
+                    if(strcmp(optarg,"netflow5")==0)
+                        exportFormat = NETFLOW5;
+                    else if(strcmp(optarg,"netflow9")==0)
+                        exportFormat = NETFLOW9;
+                    else if(strcmp(optarg,"ipfix")==0)
+                        exportFormat = IPFIX;
+                    else{
+                        printf("ERROR: --format <netflow5|netflow9|ipfix>.\n");
+                        exit(-1);
+                    }
+                }
+                else if(strcmp( "archive", long_options[longindex].name ) == 0 )
+                    archivePath = optarg;
+                else if(strcmp( "rotate", long_options[longindex].name ) == 0 )
+                    rotateTime = atoi(optarg);
+                else if(strcmp( "rotatesize", long_options[longindex].name ) == 0 )
+                    rotateSize = atoi(optarg);
+                else if(strcmp( "compress", long_options[longindex].name ) == 0 )
+                    compress = true;
+                else if(strcmp( "textformat", long_options[longindex].name ) == 0 ){
+                    if(strcmp(optarg,"pipe")==0)
+                        textFormat = TEXT_PIPE;
+                    else if(strcmp(optarg,"ndjson")==0)
+                        textFormat = TEXT_NDJSON;
+                    else{
+                        printf("ERROR: --textformat <pipe|ndjson>.\n");
+                        exit(-1);
+                    }
+                }
+                else if(strcmp( "evict", long_options[longindex].name ) == 0 ){
+                    evict = atof(optarg);
+                    if(evict<=0 || evict>100){
+                        printf("ERROR: --evict <percent> must be greater than 0 and at most 100.\n");
+                        exit(-1);
+                    }
+                }
                 break;
             default:
                 fprintf(stderr,"Unknown option.\n");
                 exit(-1);
          }
+    if(rawSlices && kernelParsing){
+        printf("ERROR: --rawslices and --kernelparsing can't be used together.\n");
+        exit(-1);
+    }
+    /**The kernel parses the outer headers of the tunnels.**/
+    if(decapTunnels && kernelParsing){
+        printf("ERROR: --decap and --kernelparsing can't be used together.\n");
+        exit(-1);
+    }
+    if(farm && (sequential || readers>1 || !indipendent_exporter)){
+        printf("ERROR: --farm requires one reader and an indipendent exporter (and can't be used with --sequential).\n");
+        exit(-1);
+    }
+    if(indipendent_exporter>1 && (!farm || indipendent_exporter>workers || indipendent_exporter>256)){
+        printf("ERROR: more than one exporter requires --farm and at most one exporter for each worker.\n");
+        exit(-1);
+    }
     if(interface==NULL){
         printf("ERROR: -i <interface> required.\n");
         exit(-1);
     }
-    assert(hashSize%(workers)==0);
+    if(outputPath==NULL && (rotateTime || rotateSize || compress)){
+        printf("ERROR: --rotate, --rotatesize and --compress require -f <outputFile>.\n");
+        exit(-1);
+    }
+    /**The exporters give the formatted flows to the writer thread of the output.**/
+    if(outputPath!=NULL)
+        output=new FlowOutput(outputPath,FlowPrinter::header(),rotateTime,(u_int64_t)rotateSize*1024*1024,compress);
+    uint evictFlows=std::max(1u,(uint)(maxActiveFlows*(double)evict/100));
+    /**Each exporter fills its own blocks of the archive.**/
+    FlowArchive *archive=NULL;
+    if(archivePath!=NULL)
+        archive=new FlowArchive(archivePath,std::max(1u,indipendent_exporter));
 
     timeval systemStartTime;
     gettimeofday(&systemStartTime,NULL);
     uint32_t sst=systemStartTime.tv_sec*1000+systemStartTime.tv_usec/1000;
-    handle=new pfring*[readers];
+    sources=new PacketSource*[readers];
     numReaders=readers;
     plast=new uint[readers];
-    for(uint i=0; i<readers; i++) plast[i]=0;
+    for(uint i=0; i<readers; i++){
+        plast[i]=0;
+        sources[i]=NULL;
+    }
     /**Sequential execution**/
     if(sequential){
 #ifdef MULTIPLE_READERS
@@ -253,9 +408,10 @@ int main(int argc, char** argv){
         sigaction(SIGINT,&s,NULL);
         const uint core=(cores!=NULL)?cores[0]:1;
         /**Creates the first stage of the pipeline (reader).**/
-        firstStage sniffer(workers,interface,promisc,cnt,hashSize,0,core);
-        genericStage worker(0,hashSize,maxActiveFlows,idle,lifetime,flowsPerTaskCheck,core);
+        firstStage sniffer(workers,interface,source,promisc,cnt,burst,rawSlices,kernelParsing,0,core);
+        genericStage worker(0,hashSize,maxActiveFlows,evictFlows,idle,lifetime,flowsPerTaskCheck,table,core);
         lastStage last(output,queueTimeout,collector,port,minFlowSize,sst,core);
+        last.setArchive(archive,0);
         ff_mapThreadToCpu(core,-20);
         alarm(5);
         void * t;
@@ -304,7 +460,7 @@ int main(int argc, char** argv){
                 }
                 rBuffers[i]=new ff::FFBUFFER(BUFFER_SIZE,true);
                 rBuffers[i]->init();
-                rThreads[i]=new readerThread(rBuffers[i],new firstStage(workers,iface,promisc,cnt,hashSize,i,cores[i]));
+                rThreads[i]=new readerThread(rBuffers[i],new firstStage(workers,iface,source,promisc,cnt,burst,rawSlices,kernelParsing,i,cores[i]));
                 iface=strtok(NULL,"_");
             }
             if(iface!=NULL)
@@ -314,13 +470,16 @@ int main(int argc, char** argv){
             genericStage** workerNodes=new genericStage*[workers];
             int workerHs=hashSize/workers;
             for(uint i=0; i<workers; i++)
-                workerNodes[i]=new genericStage(i,workerHs,maxActiveFlows,idle,lifetime,flowsPerTaskCheck,cores[i+readers]);
+                workerNodes[i]=new genericStage(i,workerHs,maxActiveFlows,evictFlows,idle,lifetime,flowsPerTaskCheck,table,cores[i+readers]);
             my_pipeline x(BUFFER_SIZE,BUFFER_SIZE,true);
             for(uint i=1; i<workers-1; i++)
                 x.add_stage(workerNodes[i]);
 
             /**Creates the last stage of the pipeline (exported).**/
             lastStage *last=new lastStage(output,queueTimeout,collector,port,minFlowSize,sst,cores[numThreads-1]);
+            last->setArchive(archive,0);
+            /**Each reader sends a task with the eof flag.**/
+            last->setProducers(readers);
             workerAndExporter *wae=NULL;
             ff::ff_node *gatherNode=workerNodes[0];;
             if(indipendent_exporter){
@@ -335,7 +494,7 @@ int main(int argc, char** argv){
                     gatherNode=wae;
             }
             gatherThread *gThread;
-            if(x.cardinality()>0){
+            if(x.getStages().size()>0){
                 x.run();
                 x.create_input_buffer(BUFFER_SIZE,true);
                 gThread=new gatherThread(rBuffers, x.get_in_buffer(), readers, gatherNode);
@@ -398,31 +557,105 @@ int main(int argc, char** argv){
             exit(-1);
 #else
         /**Only one reader.**/
-            ff::ff_pipeline pipe(BUFFER_SIZE,BUFFER_SIZE,true);
-            firstStage sniffer(workers,interface,promisc,cnt,hashSize,0,cores[0]);
-            pipe.add_stage(&sniffer);
+            ff::ff_pipeline pipe(false,BUFFER_SIZE,BUFFER_SIZE,true);
+            ff::ff_farm<> *workersFarm=NULL;
+            if(farm) workersFarm=new ff::ff_farm<>(false,BUFFER_SIZE,BUFFER_SIZE,false,workers,true);
+            firstStage sniffer(workers,interface,source,promisc,cnt,burst,rawSlices,kernelParsing,0,cores[0],
+                               farm?workersFarm->getlb():NULL);
             genericStage** stages=new genericStage*[workers];
             int workerHs=hashSize/workers;
             for(uint i=0; i<workers; i++)
-                stages[i]=new genericStage(i,workerHs,maxActiveFlows,idle,lifetime,flowsPerTaskCheck,cores[i+1]);
-            /**Adds the workers to the pipeline.**/
-            for(uint i=0; i<workers-1; i++)
-                pipe.add_stage(stages[i]);
+                stages[i]=new genericStage(i,workerHs,maxActiveFlows,evictFlows,idle,lifetime,flowsPerTaskCheck,table,cores[i+1]);
 
             workerAndExporter *wae=NULL;
             /**Creates the last stage of the pipeline (exported).**/
             lastStage last(output,queueTimeout,collector,port,minFlowSize,sst,cores[numThreads-1]);
-            if(indipendent_exporter){
-                pipe.add_stage(stages[workers-1]);
-                pipe.add_stage(&last);
+            last.setArchive(archive,0);
+            if(farm){
+                /**The reader is the emitter of the farm and the exporter its collector.**/
+                std::vector<ff::ff_node*> farmWorkers(stages,stages+workers);
+                workersFarm->add_emitter(&sniffer);
+                workersFarm->add_workers(farmWorkers);
+                if(indipendent_exporter==1){
+                    workersFarm->add_collector(&last);
+                    last.setProducers(workers);
+                    /**Starts the computation and waits for the end.**/
+                    workersFarm->run_and_wait_end();
+                    std::cout << std::endl;
+                    workersFarm->ffStats(std::cout);
+                }else{
+                    /**
+                     * The farm has no collector, each worker sends its tasks to an exporter through a buffer.
+                     * The exporter e receives the tasks of the workers w such that w%exporters==e.
+                     */
+                    uint exporters=indipendent_exporter;
+                    lastStage **lasts=new lastStage*[exporters];
+                    ff::FFBUFFER ***eBuffers=new ff::FFBUFFER**[exporters];
+                    gatherThread **eThreads=new gatherThread*[exporters];
+                    lasts[0]=&last;
+                    for(uint e=0; e<exporters; e++){
+                        if(e!=0)
+                            lasts[e]=new lastStage(output,queueTimeout,collector,port,minFlowSize,sst,cores[readers+workers+e-1]);
+                        lasts[e]->setEngineId(e);
+                        lasts[e]->setArchive(archive,e);
+                        uint producers=(workers-e+exporters-1)/exporters;
+                        lasts[e]->setProducers(producers);
+                        eBuffers[e]=new ff::FFBUFFER*[producers];
+                        for(uint p=0; p<producers; p++){
+                            /**The FastFlow buffers must be aligned to a cache line.**/
+                            void* m=getAlignedMemory(128,sizeof(ff::FFBUFFER));
+                            if(m==NULL){
+                                fprintf(stderr,"Impossible to allocate the buffers of the exporters.\n");
+                                exit(-1);
+                            }
+                            eBuffers[e][p]=new (m) ff::FFBUFFER(BUFFER_SIZE,true);
+                            eBuffers[e][p]->init();
+                            stages[e+p*exporters]->setOutputBuffer(eBuffers[e][p]);
+                        }
+                        eThreads[e]=new gatherThread(eBuffers[e],NULL,producers,lasts[e]);
+                    }
+                    /**Starts the computation and waits for the end.**/
+                    for(uint e=0; e<exporters; e++)
+                        eThreads[e]->start();
+                    workersFarm->run_and_wait_end();
+                    for(uint e=0; e<exporters; e++)
+                        eThreads[e]->wait();
+                    std::cout << std::endl;
+                    workersFarm->ffStats(std::cout);
+                    for(uint e=0; e<exporters; e++){
+                        eThreads[e]->stats(std::cout);
+                        uint producers=(workers-e+exporters-1)/exporters;
+                        for(uint p=0; p<producers; p++){
+                            eBuffers[e][p]->~FFBUFFER();
+                            freeAlignedMemory(eBuffers[e][p]);
+                        }
+                        delete[] eBuffers[e];
+                        delete eThreads[e];
+                        if(e!=0)
+                            delete lasts[e];
+                    }
+                    delete[] eThreads;
+                    delete[] eBuffers;
+                    delete[] lasts;
+                }
+                delete workersFarm;
             }else{
-                wae=new workerAndExporter(stages[workers-1],&last);
-                pipe.add_stage(wae);
+                pipe.add_stage(&sniffer);
+                /**Adds the workers to the pipeline.**/
+                for(uint i=0; i<workers-1; i++)
+                    pipe.add_stage(stages[i]);
+                if(indipendent_exporter){
+                    pipe.add_stage(stages[workers-1]);
+                    pipe.add_stage(&last);
+                }else{
+                    wae=new workerAndExporter(stages[workers-1],&last);
+                    pipe.add_stage(wae);
+                }
+                /**Starts the computation and waits for the end.**/
+                pipe.run_and_wait_end();
+                std::cout << std::endl;
+                pipe.ffStats(std::cout);
             }
-            /**Starts the computation and waits for the end.**/
-            pipe.run_and_wait_end();
-            std::cout << std::endl;
-            pipe.ffStats(std::cout);
             if(wae) delete wae;
 #ifdef COMPUTE_STATS
             float *avg_latencies=new float[workers];
@@ -442,7 +675,11 @@ int main(int argc, char** argv){
         }
         delete[] cores;
     }
+    if(output!=NULL)
+        delete output;
+    if(archive!=NULL)
+        delete archive;
     delete[] plast;
-    delete[] handle;
+    delete[] sources;
     return 0;
 }
@@ -0,0 +1,428 @@
+/*
+ * ffProbeQuery.cpp
+ *
+ * \date 16/10/2026
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * Queries the archives written with --archive. The archives are mapped in memory, the blocks whose
+ * summary can't match the query are skipped and the columns of the others are scanned one predicate
+ * at a time.
+ */
+
+#include "archive.hpp"
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Prints information on the program.
+ * \param progName The name of the program.
+ */
+void printHelp(char* progName){
+fprintf(stderr,"\nusage: %s [-a <address>] [-s <srcaddr>] [-d <dstaddr>] [-p <port>] [--srcport <port>] [--dstport <port>]\n"
+        "[-P <protocol>] [-b <begin>] [-e <end>] [-c] [-h] <archive> [<archive> ...]\n\n\n", progName);
+fprintf(stderr,"[-a <address>]                 | Flows with the specified (IPv4 or IPv6) source or destination address\n");
+fprintf(stderr,"[-s <srcaddr>]                 | Flows with the specified source address\n");
+fprintf(stderr,"[-d <dstaddr>]                 | Flows with the specified destination address\n");
+fprintf(stderr,"[-p <port>]                    | Flows with the specified source or destination port\n");
+fprintf(stderr,"[--srcport <port>]             | Flows with the specified source port\n");
+fprintf(stderr,"[--dstport <port>]             | Flows with the specified destination port\n");
+fprintf(stderr,"[-P <protocol>]                | Flows with the specified IP protocol (e.g. 6 for TCP)\n");
+fprintf(stderr,"[-b <begin>]                   | Flows active after the specified time (seconds since 0000 UTC 1970 or\n"
+        "                               | \"YYYY-MM-DD HH:MM:SS\" in local time)\n");
+fprintf(stderr,"[-e <end>]                     | Flows active before the specified time (as -b)\n");
+fprintf(stderr,"[-c]                           | Prints only the number of flows that match\n");
+fprintf(stderr,"[-h]                           | Prints this help\n");
+fprintf(stderr,"The flows are printed in the same format of ffProbe -f. Statistics on the blocks skipped are printed on stderr.\n");
+}
+
+/* An array describing valid long options.  */
+static const struct option long_options[] = {
+  { "srcport",     required_argument, NULL, 0 },
+  { "dstport",     required_argument, NULL, 0 },
+  { NULL,       0, NULL, 0   }   /* Required at end of array.  */
+};
+
+/**
+ * An address of the query.
+ */
+struct queryAddress{
+    bool used; ///<True if the address is part of the query.
+    u_int8_t addr[16] __attribute__((aligned(16))); ///<The address, as stored in the archive.
+    u_int8_t ipVersion; ///<4 or 6.
+    u_int64_t hash; ///<Hash of the address for the bloom filter.
+};
+
+/**
+ * A query. The flows must match all the specified fields.
+ */
+struct query{
+    queryAddress any, src, dst;
+    int anyPort, srcPort, dstPort, prot; ///<-1 if not specified.
+    u_int64_t begin, end; ///<Milliseconds since 0000 UTC 1970.
+    bool count;
+};
+
+/**
+ * Counters of the scan.
+ */
+struct queryStats{
+    u_int64_t blocks, skipped, scanned, matched;
+};
+
+/**
+ * Parses an address of the query.
+ * \param s The address.
+ * \param a It will contain the address.
+ */
+static void parseAddress(const char* s, queryAddress& a){
+    memset(a.addr,0,16);
+    if(inet_pton(AF_INET,s,a.addr)==1)
+        a.ipVersion=4;
+    else if(inet_pton(AF_INET6,s,a.addr)==1)
+        a.ipVersion=6;
+    else{
+        printf("ERROR: %s is not an IPv4 or IPv6 address.\n",s);
+        exit(-1);
+    }
+    a.hash=archiveHash(a.addr);
+    a.used=true;
+}
+
+/**
+ * Parses a time of the query.
+ * \param s The time (seconds since 0000 UTC 1970 or "YYYY-MM-DD HH:MM:SS" in local time).
+ * \return The time in milliseconds since 0000 UTC 1970.
+ */
+static u_int64_t parseTime(const char* s){
+    char* e;
+    unsigned long long t=strtoull(s,&e,10);
+    if(*s!='\0' && *e=='\0')
+        return t*1000;
+    struct tm tm;
+    memset(&tm,0,sizeof(tm));
+    e=strptime(s,"%Y-%m-%d %H:%M:%S",&tm);
+    if(e==NULL || *e!='\0'){
+        printf("ERROR: %s is not a valid time.\n",s);
+        exit(-1);
+    }
+    tm.tm_isdst=-1;
+    return (u_int64_t)mktime(&tm)*1000;
+}
+
+/**
+ * Parses a port or a protocol of the query.
+ * \param s The value.
+ * \param max The maximum value.
+ */
+static int parseNumber(const char* s, int max){
+    int v=atoi(s);
+    if(v<0 || v>max){
+        printf("ERROR: %s must be between 0 and %d.\n",s,max);
+        exit(-1);
+    }
+    return v;
+}
+
+/**
+ * Checks if an address can be in a block.
+ * \param bloom The bloom filter of the block.
+ * \param a The address.
+ */
+static inline bool mayContain(const u_int8_t* bloom, const queryAddress& a){
+    for(uint k=0; k<ARCHIVE_BLOOM_HASHES; k++){
+        u_int32_t b=archiveBloomBit(a.hash,k);
+        if(!(bloom[b>>3]&(1<<(b&7))))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Checks if the summary of a block can match the query.
+ * \param h The header of the block.
+ * \param q The query.
+ */
+static bool blockMatches(const archiveBlockHeader* h, const query& q){
+    if(h->count==0 || h->maxLast<q.begin || h->minFirst>q.end)
+        return false;
+    if(q.srcPort>=0 && (q.srcPort<h->minSrcPort || q.srcPort>h->maxSrcPort))
+        return false;
+    if(q.dstPort>=0 && (q.dstPort<h->minDstPort || q.dstPort>h->maxDstPort))
+        return false;
+    if(q.anyPort>=0 && (q.anyPort<h->minSrcPort || q.anyPort>h->maxSrcPort) &&
+                       (q.anyPort<h->minDstPort || q.anyPort>h->maxDstPort))
+        return false;
+    if(q.prot>=0 && (q.prot<h->minProt || q.prot>h->maxProt))
+        return false;
+    /**The source and destination addresses are in the same filter.**/
+    const u_int8_t* bloom=(const u_int8_t*) h+ARCHIVE_BLOOM_OFFSET;
+    if(q.any.used && !mayContain(bloom,q.any))
+        return false;
+    if(q.src.used && !mayContain(bloom,q.src))
+        return false;
+    if(q.dst.used && !mayContain(bloom,q.dst))
+        return false;
+    return true;
+}
+
+/**
+ * Sets to 0 the flows whose address is not the one of the query.
+ * \param m The flows that match the query (1 if the flow matches).
+ * \param col The column of the addresses.
+ * \param n The number of flows.
+ * \param a The address.
+ * \param alt If not NULL, a flow also matches if it is set to 1 in alt (e.g. if its other address matches).
+ */
+static void matchAddress(u_int8_t* m, const u_int8_t* col, uint n, const queryAddress& a, u_int8_t* alt=NULL){
+#ifdef __SSE2__
+    const __m128i v=_mm_load_si128((const __m128i*)a.addr);
+    for(uint i=0; i<n; i++){
+        u_int8_t eq=_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)(col+16*i)),v))==0xffff;
+        m[i]&=(alt!=NULL)?(eq|alt[i]):eq;
+    }
+#else
+    for(uint i=0; i<n; i++){
+        u_int8_t eq=memcmp(col+16*i,a.addr,16)==0;
+        m[i]&=(alt!=NULL)?(eq|alt[i]):eq;
+    }
+#endif
+}
+
+/**
+ * Prints a flow in the format of ffProbe -f.
+ * \param b The block.
+ * \param h The header of the archive.
+ * \param i The flow.
+ */
+static void printFlow(const u_char* b, const archiveHeader& h, uint i){
+    char src[INET6_ADDRSTRLEN],dst[INET6_ADDRSTRLEN];
+    int af=(b[h.columnOffset[COL_IPVERSION]+i]==6)?AF_INET6:AF_INET;
+    inet_ntop(af,b+h.columnOffset[COL_SRCADDR]+16*i,src,sizeof(src));
+    inet_ntop(af,b+h.columnOffset[COL_DSTADDR]+16*i,dst,sizeof(dst));
+    printf("%s|%s|%u|%u|%llu|%llu|%u|%u|%u|%u|%u|%u|%u|\n",src,dst,
+           ((const u_int32_t*) (b+h.columnOffset[COL_DPKTS]))[i],
+           ((const u_int32_t*) (b+h.columnOffset[COL_DOCTETS]))[i],
+           (unsigned long long) ((const u_int64_t*) (b+h.columnOffset[COL_FIRST]))[i]/1000,
+           (unsigned long long) ((const u_int64_t*) (b+h.columnOffset[COL_LAST]))[i]/1000,
+           ((const u_int16_t*) (b+h.columnOffset[COL_SRCPORT]))[i],
+           ((const u_int16_t*) (b+h.columnOffset[COL_DSTPORT]))[i],
+           b[h.columnOffset[COL_TCPFLAGS]+i],
+           b[h.columnOffset[COL_PROT]+i],
+           b[h.columnOffset[COL_TOS]+i],
+           ((const u_int16_t*) (b+h.columnOffset[COL_VLANID]))[i],
+           ((const u_int32_t*) (b+h.columnOffset[COL_TUNNELID]))[i]);
+}
+
+/**
+ * Scans a block. Each predicate is evaluated on a whole column, so the loops are vectorized.
+ * \param b The block.
+ * \param h The header of the archive.
+ * \param q The query.
+ * \param m Memory for the flows that match (h.blockRecords bytes).
+ * \param tmp Memory for the flows that match a part of the query (h.blockRecords bytes).
+ * \param stats The counters of the scan.
+ */
+static void scanBlock(const u_char* b, const archiveHeader& h, const query& q, u_int8_t* m, u_int8_t* tmp,
+                      queryStats& stats){
+    const uint n=((const archiveBlockHeader*) b)->count;
+    const u_int8_t *ver=b+h.columnOffset[COL_IPVERSION];
+    const u_int64_t *first=(const u_int64_t*) (b+h.columnOffset[COL_FIRST]),
+                    *last=(const u_int64_t*) (b+h.columnOffset[COL_LAST]);
+    const u_int16_t *sp=(const u_int16_t*) (b+h.columnOffset[COL_SRCPORT]),
+                    *dp=(const u_int16_t*) (b+h.columnOffset[COL_DSTPORT]);
+    const u_int8_t *prot=b+h.columnOffset[COL_PROT];
+    const u_int64_t begin=q.begin,end=q.end;
+    for(uint i=0; i<n; i++)
+        m[i]=(first[i]<=end)&(last[i]>=begin);
+    if(q.prot>=0){
+        const u_int8_t p=q.prot;
+        for(uint i=0; i<n; i++)
+            m[i]&=prot[i]==p;
+    }
+    if(q.srcPort>=0){
+        const u_int16_t p=q.srcPort;
+        for(uint i=0; i<n; i++)
+            m[i]&=sp[i]==p;
+    }
+    if(q.dstPort>=0){
+        const u_int16_t p=q.dstPort;
+        for(uint i=0; i<n; i++)
+            m[i]&=dp[i]==p;
+    }
+    if(q.anyPort>=0){
+        const u_int16_t p=q.anyPort;
+        for(uint i=0; i<n; i++)
+            m[i]&=(sp[i]==p)|(dp[i]==p);
+    }
+    const queryAddress* addrs[3]={&q.any,&q.src,&q.dst};
+    for(uint k=0; k<3; k++){
+        const queryAddress& a=*addrs[k];
+        if(!a.used)
+            continue;
+        /**The IPv4 addresses are stored as IPv6 addresses with the last 12 bytes set to 0.**/
+        const u_int8_t v=a.ipVersion;
+        for(uint i=0; i<n; i++)
+            m[i]&=ver[i]==v;
+        if(k==0){
+            memset(tmp,1,n);
+            matchAddress(tmp,b+h.columnOffset[COL_DSTADDR],n,a);
+            matchAddress(m,b+h.columnOffset[COL_SRCADDR],n,a,tmp);
+        }else
+            matchAddress(m,b+h.columnOffset[k==1?COL_SRCADDR:COL_DSTADDR],n,a);
+    }
+    stats.scanned+=n;
+    for(uint i=0; i<n; i++){
+        if(m[i]){
+            ++stats.matched;
+            if(!q.count)
+                printFlow(b,h,i);
+        }
+    }
+}
+
+/**
+ * Runs the query on an archive.
+ * \param path The archive.
+ * \param q The query.
+ * \param stats The counters of the scan.
+ */
+static void queryArchive(const char* path, const query& q, queryStats& stats){
+    int fd=open(path,O_RDONLY);
+    if(fd<0){
+        perror(path);
+        exit(-1);
+    }
+    struct stat st;
+    fstat(fd,&st);
+    if(st.st_size<ARCHIVE_ALIGN){
+        fprintf(stderr,"%s is not an archive.\n",path);
+        exit(-1);
+    }
+    const u_char* a=(const u_char*) mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    if(a==MAP_FAILED){
+        perror(path);
+        exit(-1);
+    }
+    archiveHeader h;
+    memcpy(&h,a,sizeof(h));
+    if(h.magic!=ARCHIVE_MAGIC || h.version!=ARCHIVE_VERSION || h.columns!=ARCHIVE_COLUMNS ||
+       memcmp(h.columnWidth,archiveColumnWidth,ARCHIVE_COLUMNS) || h.bloomBits!=ARCHIVE_BLOOM_BITS ||
+       h.bloomHashes!=ARCHIVE_BLOOM_HASHES){
+        fprintf(stderr,"%s is not an archive of version %d.\n",path,ARCHIVE_VERSION);
+        exit(-1);
+    }
+    u_int8_t *m=new u_int8_t[h.blockRecords],*tmp=new u_int8_t[h.blockRecords];
+    /**A block being written (if the archive is still open) is ignored.**/
+    for(u_int64_t off=h.headerSize; off+h.blockSize<=(u_int64_t)st.st_size; off+=h.blockSize){
+        const archiveBlockHeader* bh=(const archiveBlockHeader*) (a+off);
+        if(bh->magic!=ARCHIVE_BLOCK_MAGIC){
+            fprintf(stderr,"%s: corrupted block at offset %lld.\n",path,(long long) off);
+            break;
+        }
+        ++stats.blocks;
+        if(!blockMatches(bh,q)){
+            ++stats.skipped;
+            continue;
+        }
+        scanBlock(a+off,h,q,m,tmp,stats);
+    }
+    delete[] m;
+    delete[] tmp;
+    munmap((void*) a,st.st_size);
+    close(fd);
+}
+
+int main(int argc, char** argv){
+    query q;
+    memset(&q,0,sizeof(q));
+    q.anyPort=q.srcPort=q.dstPort=q.prot=-1;
+    q.end=~(u_int64_t)0;
+    int c,longindex;
+    while ((c = getopt_long (argc, argv, "a:s:d:p:P:b:e:ch", long_options, &longindex)) != -1)
+        switch (c){
+            case 'a':
+                parseAddress(optarg,q.any);
+                break;
+            case 's':
+                parseAddress(optarg,q.src);
+                break;
+            case 'd':
+                parseAddress(optarg,q.dst);
+                break;
+            case 'p':
+                q.anyPort=parseNumber(optarg,65535);
+                break;
+            case 'P':
+                q.prot=parseNumber(optarg,255);
+                break;
+            case 'b':
+                q.begin=parseTime(optarg);
+                break;
+            case 'e':
+                /**All the milliseconds of the last second are included.**/
+                q.end=parseTime(optarg)+999;
+                break;
+            case 'c':
+                q.count=true;
+                break;
+            case 'h':
+                printHelp(argv[0]);
+                exit(0);
+            case 0:
+                if(strcmp( "srcport", long_options[longindex].name ) == 0 )
+                    q.srcPort=parseNumber(optarg,65535);
+                else if(strcmp( "dstport", long_options[longindex].name ) == 0 )
+                    q.dstPort=parseNumber(optarg,65535);
+                break;
+            default:
+                fprintf(stderr,"Unknown option.\n");
+                exit(-1);
+        }
+    if(optind>=argc){
+        printf("ERROR: at least one archive required.\n");
+        printHelp(argv[0]);
+        exit(-1);
+    }
+    queryStats stats;
+    memset(&stats,0,sizeof(stats));
+    if(!q.count)
+        printf("IPV4_SRC_ADDR|IPV4_DST_ADDR|OUT_PKTS|OUT_BYTES|FIRST_SWITCHED|LAST_SWITCHED|L4_SRC_PORT|L4_DST_PORT|TCP_FLAGS|"
+               "PROTOCOL|SRC_TOS|SRC_VLAN|TUNNEL_ID|\n");
+    for(int i=optind; i<argc; i++)
+        queryArchive(argv[i],q,stats);
+    if(q.count)
+        printf("%llu\n",(unsigned long long) stats.matched);
+    fprintf(stderr,"Blocks: %llu (%llu skipped). Flows scanned: %llu, matched: %llu.\n",
+            (unsigned long long) stats.blocks,(unsigned long long) stats.skipped,
+            (unsigned long long) stats.scanned,(unsigned long long) stats.matched);
+    return 0;
+}
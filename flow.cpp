@@ -1,135 +1,414 @@
-/*
- * flow.cpp
- *
- * \date 14/mag/2010
- * \author Daniele De Sensi (d.desensi.software@gmail.com)
- * =========================================================================
- *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
- *
- *  This file is part of ffProbe.
- *
- *  ffProbe is free software: you can redistribute it and/or
- *  modify it under the terms of the Lesser GNU General Public
- *  License as published by the Free Software Foundation, either
- *  version 3 of the License, or (at your option) any later version.
-
- *  ffProbe is distributed in the hope that it will be useful,
- *  but WITHOUT ANY WARRANTY; without even the implied warranty of
- *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *  Lesser GNU General Public License for more details.
- *
- *  You should have received a copy of the Lesser GNU General Public
- *  License along with ffProbe.
- *  If not, see <http://www.gnu.org/licenses/>.
- *
- * =========================================================================
- *
- * Contains functions for creations and exportations of the flows.
- */
-
- #include "flow.hpp"
-
-
- /**
-  * Constructor of the exporter.
-  * \param collectorAddress The ipv4 address of the collector.
-  * \param port The port on which is listening the collector.
-  * \param systemStartTime The system start time.
-  */
- Exporter::Exporter(const char* collectorAddress, ushort port, uint32_t systemStartTime):systemStartTime(systemStartTime){
-     /* Create socket */
-     if ( (sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-         perror("Socket creation error");
-         exit(-1);
-     }
-     /* Initialize address */
-     memset((void *) &addr, 0, sizeof(addr));
-     addr.sin_family = AF_INET;
-     addr.sin_port = htons(port);
-     /* Build address using inet_pton */
-     if ( (inet_pton(AF_INET,collectorAddress, &addr.sin_addr)) <= 0) {
-         perror("Address creation error");
-         exit(-1);
-     }
- }
-
- /**
-  * Prints the flow in a file.
-  * \param out The file where to print the flow.
-  * \param f The flow to print.
-  */
- void Exporter::printFlow(FILE* out,hashElement& f){
-     struct in_addr struaddr;
-     /**inet_ntoa need the address in network byte order.**/
-     struaddr.s_addr=f.srcaddr;
-     char* addr=inet_ntoa(struaddr);
-     fprintf(out,"%s|", addr);
-     struaddr.s_addr=f.dstaddr;
-     addr=inet_ntoa(struaddr);
-     fprintf(out,"%s|", addr);
-     fprintf(out,"%d|",f.dPkts);
-     fprintf(out,"%d|",f.dOctets);
-     fprintf(out,"%d|",f.First.tv_sec);
-     fprintf(out,"%d|",f.Last.tv_sec);
-     fprintf(out,"%d|",ntohs(f.srcport));
-     fprintf(out,"%d|",ntohs(f.dstport));
-     fprintf(out,"%d|",f.tcp_flags);
-     fprintf(out,"%d|",f.prot);
-     fprintf(out,"%d|",f.tos);
-     fprintf(out,"\n");
- }
-
- /**
-  * Sends the expired flows to the collector.
-  * \param q A queue of expired flows.
-  * \param flowSequence The sequence number of the next record.
-  * \param out A pointer to the file where to print the flows.
-  */
- uint Exporter::sendToCollector(std::queue<hashElement>* q, u_int32_t flowSequence, FILE* out){
-     uint size=q->size();
-     if(size>MAX_FLOW_NUM)
-         return -1;
-     netflow5_record record;
-     flow_ver5_hdr hdr;
-     memset((void *) &record, 0, sizeof(record));
-     hdr.version=htons(5);
-     hdr.count=htons(q->size());
-     timeval now;
-     gettimeofday(&now,NULL);
-     u_int32_t uptime=now.tv_sec*1000+now.tv_usec/1000-systemStartTime;
-     hdr.sysUptime=htonl(uptime);
-     hdr.unix_secs=htonl(now.tv_sec);
-     hdr.unix_nsecs=htonl(now.tv_usec/1000);
-     hdr.flow_sequence=htonl(flowSequence);
-     hdr.engine_type=hdr.engine_id=hdr.sampling_interval=0;
-     record.flowHeader=hdr;
-     hashElement f;
-     flow_ver5_rec fr;
-     fr.src_as=fr.dst_as=fr.dst_mask=fr.src_mask=fr.input=fr.output=fr.nexthop=fr.pad1=fr.pad2=0; //TODO Add routing informations
-     uint i;
-     for(i=0; !q->empty(); i++){
-         f=q->front();
-         q->pop();
-         if(out!=NULL)
-             printFlow(out,f);
-         fr.srcaddr=f.srcaddr;
-         fr.dstaddr=f.dstaddr;
-         fr.srcport=f.srcport;
-         fr.dstport=f.dstport;
-         fr.tos=f.tos;
-         fr.tcp_flags=f.tcp_flags;
-         fr.prot=f.prot;
-         fr.First=htonl(f.First.tv_sec*1000+f.First.tv_usec/1000-systemStartTime);
-         fr.Last=htonl(f.Last.tv_sec*1000+f.Last.tv_usec/1000-systemStartTime);
-         fr.dOctets=htonl(f.dOctets);
-         fr.dPkts=htonl(f.dPkts);
-         record.flowRecord[i]=fr;
-     }
-
-     if (sendto(sock,&record,sizeof(record)-((MAX_FLOW_NUM-size)*sizeof(flow_ver5_rec)), 0, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-         perror("Request error");
-         return -1;
-     }
-     return 0;
- }
-
+/*
+ * flow.cpp
+ *
+ * \date 14/mag/2010
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * Contains functions for creations and exportations of the flows.
+ */
+
+ #include "flow.hpp"
+ #include <errno.h>
+ #include <unistd.h>
+ #include <endian.h>
+
+ u_int16_t vlanKeyMask=0;
+ bool decapTunnels=false;
+ ExportFormat exportFormat=NETFLOW5;
+
+ /**
+  * NetFlow v9 templates describing flow_ver9_rec4 and flow_ver9_rec6 (template header and <type,length> of each field).
+  */
+ static const u_int16_t v9Template4[]={NETFLOW9_TEMPLATE_ID4, 12,
+                                       8, 4, 12, 4, 2, 4, 1, 4, 22, 4, 21, 4,
+                                       7, 2, 11, 2, 6, 1, 4, 1, 5, 1, 58, 2};
+ static const u_int16_t v9Template6[]={NETFLOW9_TEMPLATE_ID6, 12,
+                                       27, 16, 28, 16, 2, 4, 1, 4, 22, 4, 21, 4,
+                                       7, 2, 11, 2, 6, 1, 4, 1, 5, 1, 58, 2};
+
+ /**
+  * IPFIX templates describing ipfix_rec4 and ipfix_rec6 (template header and <element id,length> of each field).
+  */
+ static const u_int16_t ipfixTemplate4[]={NETFLOW9_TEMPLATE_ID4, 12,
+                                          8, 4, 12, 4, 2, 4, 1, 4, 152, 8, 153, 8,
+                                          7, 2, 11, 2, 6, 1, 4, 1, 5, 1, 58, 2};
+ static const u_int16_t ipfixTemplate6[]={NETFLOW9_TEMPLATE_ID6, 12,
+                                          27, 16, 28, 16, 2, 4, 1, 4, 152, 8, 153, 8,
+                                          7, 2, 11, 2, 6, 1, 4, 1, 5, 1, 58, 2};
+
+ /**
+  * Writes a template (or the header of a set) in network byte order.
+  * \param p Where to write the template.
+  * \param t The template.
+  * \param n The number of 16 bits words of the template.
+  * \return The number of bytes written.
+  */
+ static size_t writeWords(u_char* p, const u_int16_t* t, uint n){
+     for(uint i=0; i<n; i++){
+         u_int16_t v=htons(t[i]);
+         memcpy(p+2*i,&v,sizeof(v));
+     }
+     return 2*n;
+ }
+
+ /**
+  * Constructor of the exporter.
+  * \param collectorAddress The ipv4 address of the collector.
+  * \param port The port on which is listening the collector.
+  * \param systemStartTime The system start time.
+  */
+ Exporter::Exporter(const char* collectorAddress, ushort port, uint32_t systemStartTime):systemStartTime(systemStartTime),packetSequence(0),
+                    flowSequence(0),ipfixSequence(0),engineId(0),pending(0),lastTemplate(0),sinceTemplate(0){
+     /* Create socket */
+     if ( (sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+         perror("Socket creation error");
+         exit(-1);
+     }
+     /**A large send buffer absorbs the bursts of datagrams sent by a single sendmmsg (the kernel may reduce it).**/
+     int sndbuf=EXPORT_SNDBUF;
+     setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+     /* Initialize address */
+     memset((void *) &addr, 0, sizeof(addr));
+     addr.sin_family = AF_INET;
+     addr.sin_port = htons(port);
+     /* Build address using inet_pton */
+     if ( (inet_pton(AF_INET,collectorAddress, &addr.sin_addr)) <= 0) {
+         perror("Address creation error");
+         exit(-1);
+     }
+     numFree=EXPORT_BATCH+2;
+     buffers=new u_char[numFree*EXPORT_DATAGRAM_SIZE];
+     freeBuffers=new uint[numFree];
+     for(uint i=0; i<numFree; i++)
+         freeBuffers[i]=i;
+     memset(msgs,0,sizeof(msgs));
+     for(uint i=0; i<EXPORT_BATCH; i++){
+         msgs[i].msg_hdr.msg_name=&addr;
+         msgs[i].msg_hdr.msg_namelen=sizeof(addr);
+         msgs[i].msg_hdr.msg_iov=&iovs[i];
+         msgs[i].msg_hdr.msg_iovlen=1;
+     }
+     /**The layouts of the records are chosen once, so the flows are encoded without checking the protocol.**/
+     switch(exportFormat){
+         case NETFLOW5:
+             layout[0]=NETFLOW5_IPV4;
+             recordSize[0]=sizeof(flow_ver5_rec);
+             layout[1]=NETFLOW9_IPV6;
+             recordSize[1]=sizeof(flow_ver9_rec6);
+             break;
+         case NETFLOW9:
+             layout[0]=NETFLOW9_IPV4;
+             recordSize[0]=sizeof(flow_ver9_rec4);
+             layout[1]=NETFLOW9_IPV6;
+             recordSize[1]=sizeof(flow_ver9_rec6);
+             break;
+         case IPFIX:
+             layout[0]=IPFIX_IPV4;
+             recordSize[0]=sizeof(ipfix_rec4);
+             layout[1]=IPFIX_IPV6;
+             recordSize[1]=sizeof(ipfix_rec6);
+             break;
+     }
+     for(uint k=0; k<2; k++){
+         open[k]=-1;
+         n[k]=0;
+         if(layout[k]==NETFLOW5_IPV4){
+             recordsOffset[k]=sizeof(flow_ver5_hdr);
+             maxRecords[k]=MAX_FLOW_NUM;
+         }else if(layout[k]==NETFLOW9_IPV4 || layout[k]==NETFLOW9_IPV6){
+             /**Header, flowset header and up to 3 bytes of padding.**/
+             recordsOffset[k]=sizeof(flow_ver9_hdr)+4;
+             maxRecords[k]=(EXPORT_MTU-recordsOffset[k]-3)/recordSize[k];
+         }else{
+             recordsOffset[k]=sizeof(ipfix_hdr)+4;
+             maxRecords[k]=(EXPORT_MTU-recordsOffset[k])/recordSize[k];
+         }
+     }
+ }
+
+ /**
+  * Destructor of the exporter.
+  */
+ Exporter::~Exporter(){
+     ::close(sock);
+     delete[] buffers;
+     delete[] freeBuffers;
+ }
+
+ /**
+  * Sets the identifier of the exporter, so the collector keeps a separate sequence number for each
+  * exporter (default is 0).
+  * \param id The identifier.
+  */
+ void Exporter::setEngineId(u_int8_t id){
+     engineId=id;
+ }
+
+ /**
+  * Adds a datagram to the ones ready to be sent. If they are EXPORT_BATCH they are sent.
+  * \param buffer The index of the datagram.
+  * \param len The length of the datagram.
+  */
+ void Exporter::enqueue(uint buffer, size_t len){
+     readyBuffers[pending]=buffer;
+     iovs[pending].iov_base=getBuffer(buffer);
+     iovs[pending].iov_len=len;
+     if(++pending==EXPORT_BATCH)
+         send();
+ }
+
+ /**
+  * Sends the datagrams ready to be sent.
+  */
+ void Exporter::send(){
+     uint sent=0;
+     while(sent<pending){
+         int r=sendmmsg(sock,msgs+sent,pending-sent,0);
+         if(r<0){
+             if(errno==EINTR)
+                 continue;
+             perror("Request error");
+             break;
+         }
+         sent+=r;
+     }
+     for(uint i=0; i<pending; i++)
+         freeBuffers[numFree++]=readyBuffers[i];
+     pending=0;
+ }
+
+ /**
+  * Adds a datagram with the NetFlow v9 or IPFIX templates to the datagrams ready to be sent.
+  * \param now The current time.
+  */
+ void Exporter::sendTemplates(const timeval& now){
+     uint buffer=freeBuffers[--numFree];
+     u_char *d=getBuffer(buffer);
+     size_t len;
+     if(layout[1]==IPFIX_IPV6){
+         len=sizeof(ipfix_hdr);
+         u_int16_t set[2]={2,(u_int16_t)(4+sizeof(ipfixTemplate4)+sizeof(ipfixTemplate6))};
+         len+=writeWords(d+len,set,2);
+         len+=writeWords(d+len,ipfixTemplate4,sizeof(ipfixTemplate4)/2);
+         len+=writeWords(d+len,ipfixTemplate6,sizeof(ipfixTemplate6)/2);
+         ipfix_hdr *hdr=(ipfix_hdr*) d;
+         hdr->version=htons(10);
+         hdr->length=htons(len);
+         hdr->exportTime=htonl(now.tv_sec);
+         hdr->sequenceNumber=htonl(ipfixSequence);
+         hdr->observationDomainId=htonl(engineId);
+     }else{
+         len=sizeof(flow_ver9_hdr);
+         u_int16_t flowset[2]={0,(u_int16_t)(4+sizeof(v9Template4)+sizeof(v9Template6))};
+         len+=writeWords(d+len,flowset,2);
+         len+=writeWords(d+len,v9Template4,sizeof(v9Template4)/2);
+         len+=writeWords(d+len,v9Template6,sizeof(v9Template6)/2);
+         flow_ver9_hdr *hdr=(flow_ver9_hdr*) d;
+         hdr->version=htons(9);
+         hdr->count=htons(2);
+         hdr->sysUptime=htonl(now.tv_sec*1000+now.tv_usec/1000-systemStartTime);
+         hdr->unix_secs=htonl(now.tv_sec);
+         hdr->flow_sequence=htonl(packetSequence++);
+         hdr->source_id=htonl(engineId);
+     }
+     lastTemplate=now.tv_sec;
+     sinceTemplate=0;
+     enqueue(buffer,len);
+ }
+
+ /**
+  * Writes the headers of a datagram being filled and adds it to the datagrams ready to be sent (preceded by
+  * the templates, if they have to be sent again).
+  * \param k 0 for the datagram of the IPv4 flows, 1 for the datagram of the IPv6 flows.
+  * \param now The current time.
+  */
+ void Exporter::closeDatagram(uint k, const timeval& now){
+     u_char *d=getBuffer(open[k]);
+     size_t len=recordsOffset[k]+n[k]*recordSize[k];
+     if(layout[k]==NETFLOW5_IPV4){
+         flow_ver5_hdr *hdr=(flow_ver5_hdr*) d;
+         hdr->version=htons(5);
+         hdr->count=htons(n[k]);
+         hdr->sysUptime=htonl(now.tv_sec*1000+now.tv_usec/1000-systemStartTime);
+         hdr->unix_secs=htonl(now.tv_sec);
+         hdr->unix_nsecs=htonl(now.tv_usec/1000);
+         hdr->flow_sequence=htonl(flowSequence);
+         hdr->engine_type=0;
+         hdr->engine_id=engineId;
+         hdr->sampling_interval=htons(0);
+         flowSequence+=n[k];
+     }else{
+         /**The collector must receive the templates before the flows they describe.**/
+         if(lastTemplate==0 || now.tv_sec-lastTemplate>=EXPORT_TEMPLATE_TIMEOUT || sinceTemplate>=EXPORT_TEMPLATE_DATAGRAMS)
+             sendTemplates(now);
+         ++sinceTemplate;
+         u_int16_t templateId=(k==0)?NETFLOW9_TEMPLATE_ID4:NETFLOW9_TEMPLATE_ID6;
+         if(layout[k]==IPFIX_IPV4 || layout[k]==IPFIX_IPV6){
+             u_int16_t set[2]={templateId,(u_int16_t)(len-sizeof(ipfix_hdr))};
+             writeWords(d+sizeof(ipfix_hdr),set,2);
+             ipfix_hdr *hdr=(ipfix_hdr*) d;
+             hdr->version=htons(10);
+             hdr->length=htons(len);
+             hdr->exportTime=htonl(now.tv_sec);
+             hdr->sequenceNumber=htonl(ipfixSequence);
+             hdr->observationDomainId=htonl(engineId);
+             ipfixSequence+=n[k];
+         }else{
+             /**Data flowset, padded to 32 bits.**/
+             size_t padding=(4-len%4)%4;
+             memset(d+len,0,padding);
+             len+=padding;
+             u_int16_t flowset[2]={templateId,(u_int16_t)(len-sizeof(flow_ver9_hdr))};
+             writeWords(d+sizeof(flow_ver9_hdr),flowset,2);
+             flow_ver9_hdr *hdr=(flow_ver9_hdr*) d;
+             hdr->version=htons(9);
+             hdr->count=htons(n[k]);
+             hdr->sysUptime=htonl(now.tv_sec*1000+now.tv_usec/1000-systemStartTime);
+             hdr->unix_secs=htonl(now.tv_sec);
+             hdr->flow_sequence=htonl(packetSequence++);
+             hdr->source_id=htonl(engineId);
+         }
+     }
+     uint buffer=open[k];
+     open[k]=-1;
+     enqueue(buffer,len);
+ }
+
+ /**
+  * Encodes an expired flow in the datagram being filled.
+  * \param f The flow.
+  */
+ void Exporter::addFlow(const hashElement& f){
+     uint k=(f.ipVersion==6);
+     if(open[k]<0){
+         open[k]=freeBuffers[--numFree];
+         n[k]=0;
+     }
+     u_char *p=getBuffer(open[k])+recordsOffset[k]+n[k]*recordSize[k];
+     u_int32_t first=htonl(f.First.tv_sec*1000+f.First.tv_usec/1000-systemStartTime),
+               last=htonl(f.Last.tv_sec*1000+f.Last.tv_usec/1000-systemStartTime);
+     in6_addr a;
+     switch(layout[k]){
+         case NETFLOW5_IPV4:{
+             flow_ver5_rec *r=(flow_ver5_rec*) p;
+             r->srcaddr=f.srcaddr;
+             r->dstaddr=f.dstaddr;
+             r->srcport=f.srcport;
+             r->dstport=f.dstport;
+             r->tos=f.tos;
+             r->tcp_flags=f.tcp_flags;
+             r->prot=f.prot;
+             r->First=first;
+             r->Last=last;
+             r->dOctets=htonl(f.dOctets);
+             r->dPkts=htonl(f.dPkts);
+             r->src_as=r->dst_as=r->dst_mask=r->src_mask=r->input=r->output=r->nexthop=r->pad1=r->pad2=0; //TODO Add routing informations
+             break;
+         }
+         case NETFLOW9_IPV4:{
+             flow_ver9_rec4 *r=(flow_ver9_rec4*) p;
+             r->srcaddr=f.srcaddr;
+             r->dstaddr=f.dstaddr;
+             r->dPkts=htonl(f.dPkts);
+             r->dOctets=htonl(f.dOctets);
+             r->First=first;
+             r->Last=last;
+             r->srcport=f.srcport;
+             r->dstport=f.dstport;
+             r->tcp_flags=f.tcp_flags;
+             r->prot=f.prot;
+             r->tos=f.tos;
+             r->vlanId=htons(f.vlanId);
+             break;
+         }
+         case NETFLOW9_IPV6:{
+             flow_ver9_rec6 *r=(flow_ver9_rec6*) p;
+             getSrcAddr6(f,&a);
+             memcpy(r->srcaddr,&a,16);
+             getDstAddr6(f,&a);
+             memcpy(r->dstaddr,&a,16);
+             r->dPkts=htonl(f.dPkts);
+             r->dOctets=htonl(f.dOctets);
+             r->First=first;
+             r->Last=last;
+             r->srcport=f.srcport;
+             r->dstport=f.dstport;
+             r->tcp_flags=f.tcp_flags;
+             r->prot=f.prot;
+             r->tos=f.tos;
+             r->vlanId=htons(f.vlanId);
+             break;
+         }
+         case IPFIX_IPV4:{
+             ipfix_rec4 *r=(ipfix_rec4*) p;
+             r->srcaddr=f.srcaddr;
+             r->dstaddr=f.dstaddr;
+             r->dPkts=htonl(f.dPkts);
+             r->dOctets=htonl(f.dOctets);
+             r->First=htobe64((u_int64_t)f.First.tv_sec*1000+f.First.tv_usec/1000);
+             r->Last=htobe64((u_int64_t)f.Last.tv_sec*1000+f.Last.tv_usec/1000);
+             r->srcport=f.srcport;
+             r->dstport=f.dstport;
+             r->tcp_flags=f.tcp_flags;
+             r->prot=f.prot;
+             r->tos=f.tos;
+             r->vlanId=htons(f.vlanId);
+             break;
+         }
+         case IPFIX_IPV6:{
+             ipfix_rec6 *r=(ipfix_rec6*) p;
+             getSrcAddr6(f,&a);
+             memcpy(r->srcaddr,&a,16);
+             getDstAddr6(f,&a);
+             memcpy(r->dstaddr,&a,16);
+             r->dPkts=htonl(f.dPkts);
+             r->dOctets=htonl(f.dOctets);
+             r->First=htobe64((u_int64_t)f.First.tv_sec*1000+f.First.tv_usec/1000);
+             r->Last=htobe64((u_int64_t)f.Last.tv_sec*1000+f.Last.tv_usec/1000);
+             r->srcport=f.srcport;
+             r->dstport=f.dstport;
+             r->tcp_flags=f.tcp_flags;
+             r->prot=f.prot;
+             r->tos=f.tos;
+             r->vlanId=htons(f.vlanId);
+             break;
+         }
+     }
+     if(++n[k]==maxRecords[k]){
+         timeval now;
+         gettimeofday(&now,NULL);
+         closeDatagram(k,now);
+     }
+ }
+
+ /**
+  * Sends to the collector all the flows added (also the ones in datagrams not full).
+  */
+ void Exporter::flush(){
+     timeval now;
+     gettimeofday(&now,NULL);
+     for(uint k=0; k<2; k++)
+         if(open[k]>=0)
+             closeDatagram(k,now);
+     send();
+ }
@@ -41,6 +41,7 @@
 #include <queue>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <netinet/tcp.h>
 #include <netinet/udp.h>
 #include <netinet/ip_icmp.h>
@@ -48,15 +49,86 @@
 
 #define MAX_FLOW_NUM 30
 
+#define NETFLOW9_TEMPLATE_ID6 256 ///<Id of the NetFlow v9 (and IPFIX) template of the IPv6 flows.
+#define NETFLOW9_TEMPLATE_ID4 257 ///<Id of the NetFlow v9 (and IPFIX) template of the IPv4 flows.
+#define EXPORT_MTU 1472 ///<Maximum size of a datagram (the UDP payload of a 1500 bytes Ethernet frame).
+#define EXPORT_DATAGRAM_SIZE 1536 ///<Size of the buffer of a datagram.
+#define EXPORT_TEMPLATE_TIMEOUT 10 ///<The NetFlow v9 and IPFIX templates are sent at least every EXPORT_TEMPLATE_TIMEOUT seconds...
+#define EXPORT_TEMPLATE_DATAGRAMS 256 ///<...and every EXPORT_TEMPLATE_DATAGRAMS datagrams of flows.
+#define EXPORT_BATCH 32 ///<Maximum number of datagrams sent with a single sendmmsg call.
+#define EXPORT_SNDBUF (4*1024*1024) ///<Size requested for the send buffer of the socket of an exporter.
+
 #define TCP_PROT_NUM 0x06
 #define UDP_PROT_NUM 0x11
 
 /**
- * Element of the hash table.
+ * Ethertypes recognized when the datalink header is walked.
+ */
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88a8
+#define ETHERTYPE_QINQ_OLD 0x9100
+#define ETHERTYPE_MPLS 0x8847
+#define ETHERTYPE_MPLS_MULTI 0x8848
+
+/**
+ * Maximum number of VLAN tags and MPLS labels skipped before the IP header.
+ */
+#define MAX_L2_TAGS 8
+
+/**
+ * Maximum number of IPv6 extension headers skipped before the transport header.
+ */
+#define MAX_IPV6_EXT_HDRS 8
+
+/**
+ * Tunnels recognized when the tunnels are decapsulated.
+ */
+#define GRE_PROT_NUM 47
+#define IPIP_PROT_NUM 4
+#define IPV6_IN_IP_PROT_NUM 41
+#define ETHERTYPE_TEB 0x6558 ///<Ethernet in GRE (e.g. NVGRE).
+#define VXLAN_PORT 4789
+#define GTPU_PORT 2152
+
+/**
+ * Maximum number of nested tunnels decapsulated.
+ */
+#define MAX_TUNNEL_DEPTH 2
+
+/**
+ * Mask applied to the VLAN ID of the flows when they are compared (0 if the VLAN ID is not part
+ * of the key of the flows, 0x0fff otherwise).
+ */
+extern u_int16_t vlanKeyMask;
+
+/**
+ * True if the flows are built from the packets carried by GRE, VXLAN, GTP-U and IP-in-IP tunnels.
+ */
+extern bool decapTunnels;
+
+/**
+ * Protocols used to export the flows.
+ */
+enum ExportFormat{
+    NETFLOW5, ///<NetFlow v5 for the IPv4 flows (NetFlow v9 for the IPv6 flows, that v5 can't carry).
+    NETFLOW9, ///<NetFlow v9.
+    IPFIX     ///<IPFIX (RFC 7011).
+};
+
+/**
+ * The protocol used by the exporters.
+ */
+extern ExportFormat exportFormat;
+
+/**
+ * Element of the hash table. The IPv4 key and the counters fill the first cache line, the upper
+ * 96 bits of the IPv6 addresses follow and are read only for IPv6 flows.
  */
 struct hashElement {
-  u_int32_t srcaddr;    /* Source IP Address */
-  u_int32_t dstaddr;    /* Destination IP Address */
+  u_int32_t srcaddr;    /* Source IP Address (the lower 32 bits for IPv6) */
+  u_int32_t dstaddr;    /* Destination IP Address (the lower 32 bits for IPv6) */
   u_int32_t dPkts;      /* Packets sent */
   u_int32_t dOctets;    /* Octets sent */
   timeval First;        /* Time at start of flow */
@@ -65,10 +137,284 @@ struct hashElement {
   u_int16_t dstport;    /* TCP/UDP destination port number (.e.g, FTP, Telnet, etc.,or equivalent) */
   u_int8_t tcp_flags;   /* Cumulative OR of tcp flags */
   u_int8_t prot;        /* IP protocol, e.g., 6=TCP, 17=UDP, etc... */
-  u_int8_t tos;         /* IP Type-of-Service */
+  u_int8_t tos;         /* IP Type-of-Service (Traffic Class for IPv6) */
+  u_int8_t ipVersion;   /* 4 or 6 */
+  u_int16_t vlanId;     /* VLAN ID of the innermost 802.1Q tag (0 if untagged) */
   u_int32_t hashId;        /* Id in the hash table */
+  u_int32_t srcaddr6[3];   /* Upper 96 bits of the IPv6 source address (0 for IPv4) */
+  u_int32_t dstaddr6[3];   /* Upper 96 bits of the IPv6 destination address (0 for IPv4) */
+  u_int32_t tunnelId;      /* GRE key, VXLAN VNI or GTP-U TEID of the innermost tunnel (0 if not decapsulated) */
 };
 
+/**
+ * Initial capacity of a flowQueue.
+ */
+#define FLOW_QUEUE_CAPACITY 1024
+
+/**
+ * FIFO queue of flows stored in an array. The memory of the queue is kept when it is emptied, so a queue
+ * that is reused (see TaskPool) stops allocating memory once it has reached its largest size.
+ */
+class flowQueue{
+private:
+    hashElement *elements; ///<The flows.
+    size_t head,           ///<Position of the first flow.
+           tail,           ///<Position after the last flow.
+           capacity;       ///<Size of elements.
+public:
+    /**
+     * Constructor of the queue.
+     * \param capacity Initial capacity of the queue.
+     */
+    flowQueue(size_t capacity=FLOW_QUEUE_CAPACITY):head(0),tail(0),capacity(capacity){
+        elements=(hashElement*)malloc(capacity*sizeof(hashElement));
+    }
+
+    /**
+     * Destructor of the queue.
+     */
+    ~flowQueue(){
+        free(elements);
+    }
+
+    /**
+     * Adds a flow at the end of the queue.
+     * \param f The flow.
+     */
+    inline void push_back(const hashElement& f){
+        if(tail==capacity){
+            if(head){
+                memmove(elements,elements+head,(tail-head)*sizeof(hashElement));
+                tail-=head;
+                head=0;
+            }else{
+                capacity*=2;
+                elements=(hashElement*)realloc(elements,capacity*sizeof(hashElement));
+                if(elements==NULL){
+                    perror("Allocating a queue of flows");
+                    exit(-1);
+                }
+            }
+        }
+        elements[tail++]=f;
+    }
+
+    /**
+     * Returns the first flow of the queue.
+     */
+    inline hashElement& front(){
+        return elements[head];
+    }
+
+    /**
+     * Removes the first flow of the queue.
+     */
+    inline void pop_front(){
+        if(++head==tail) head=tail=0;
+    }
+
+    /**
+     * Returns the number of flows in the queue.
+     */
+    inline size_t size() const{
+        return tail-head;
+    }
+
+    /**
+     * Removes all the flows.
+     */
+    inline void clear(){
+        head=tail=0;
+    }
+};
+
+/**
+ * Initial capacity of a packetRecords.
+ */
+#define PACKET_RECORDS_CAPACITY 1024
+
+/**
+ * A packet passed by the reader to a worker (28 bytes instead of the 96 bytes of a hashElement). The packets
+ * that don't fit in this format (IPv6, tunneled, longer than 65535 bytes or with a timestamp too far from
+ * the first packet of their task) have also a packetExtension.
+ */
+struct packetRecord {
+    u_int32_t srcaddr, dstaddr;
+    u_int16_t srcport, dstport;
+    u_int8_t prot, tos, tcp_flags;
+    u_int8_t extended;     /* 1 if the next packetExtension belongs to this packet */
+    u_int16_t vlanId;
+    u_int16_t length;      /* dOctets of the packet */
+    u_int32_t hashId;
+    u_int32_t timestamp;   /* Microseconds after the capture of the first packet of the task */
+};
+
+/**
+ * The fields of a packet that don't fit in its packetRecord.
+ */
+struct packetExtension {
+    timeval timestamp;
+    u_int32_t length;
+    u_int32_t srcaddr6[3], dstaddr6[3];
+    u_int32_t tunnelId;
+    u_int8_t ipVersion;
+};
+
+/**
+ * The packets of a task for a worker, stored in compact records. The memory is kept when the records are
+ * cleared, so the records of a reused task are not allocated again.
+ */
+class packetRecords{
+private:
+    packetRecord *records;    ///<The packets.
+    packetExtension *exts;    ///<The extensions of the packets (in the same order).
+    uint n,                   ///<Number of packets.
+         nExts,               ///<Number of extensions.
+         capacity,            ///<Size of records.
+         extsCapacity;        ///<Size of exts.
+    timeval base;             ///<Capture time of the first packet.
+
+    /**
+     * Doubles the size of an array.
+     */
+    template<typename T> static void grow(T*& a, uint& c){
+        c*=2;
+        a=(T*)realloc(a,c*sizeof(T));
+        if(a==NULL){
+            perror("Allocating the packets of a task");
+            exit(-1);
+        }
+    }
+public:
+    /**
+     * Constructor of the records.
+     */
+    packetRecords():n(0),nExts(0),capacity(PACKET_RECORDS_CAPACITY),extsCapacity(PACKET_RECORDS_CAPACITY/16){
+        records=(packetRecord*)malloc(capacity*sizeof(packetRecord));
+        exts=(packetExtension*)malloc(extsCapacity*sizeof(packetExtension));
+    }
+
+    /**
+     * Destructor of the records.
+     */
+    ~packetRecords(){
+        free(records);
+        free(exts);
+    }
+
+    /**
+     * Adds a packet.
+     * \param f The flow of the packet (First is the capture time and dOctets the length).
+     */
+    inline void push_back(const hashElement& f){
+        if(n==capacity) grow(records,capacity);
+        if(n==0) base=f.First;
+        packetRecord& r=records[n++];
+        r.srcaddr=f.srcaddr;
+        r.dstaddr=f.dstaddr;
+        r.srcport=f.srcport;
+        r.dstport=f.dstport;
+        r.prot=f.prot;
+        r.tos=f.tos;
+        r.tcp_flags=f.tcp_flags;
+        r.vlanId=f.vlanId;
+        r.length=f.dOctets;
+        r.hashId=f.hashId;
+        int64_t us=((int64_t)f.First.tv_sec-base.tv_sec)*1000000+f.First.tv_usec-base.tv_usec;
+        r.timestamp=us;
+        r.extended=(f.ipVersion!=4 || f.tunnelId!=0 || f.dOctets>0xffff || us<0 || us>0xffffffffLL);
+        if(r.extended){
+            if(nExts==extsCapacity) grow(exts,extsCapacity);
+            packetExtension& e=exts[nExts++];
+            e.timestamp=f.First;
+            e.length=f.dOctets;
+            memcpy(e.srcaddr6,f.srcaddr6,sizeof(e.srcaddr6));
+            memcpy(e.dstaddr6,f.dstaddr6,sizeof(e.dstaddr6));
+            e.tunnelId=f.tunnelId;
+            e.ipVersion=f.ipVersion;
+        }
+    }
+
+    /**
+     * Returns the number of packets.
+     */
+    inline uint size() const{
+        return n;
+    }
+
+    /**
+     * Returns the hash of the flow of a packet.
+     * \param i The packet.
+     */
+    inline u_int32_t getHashId(uint i) const{
+        return records[i].hashId;
+    }
+
+    /**
+     * Rebuilds the flow of a packet. The packets must be read in order.
+     * \param i The packet.
+     * \param e The number of extensions already read (it is updated).
+     * \param f It will contain the flow of the packet (First is the capture time and dOctets the length).
+     */
+    inline void get(uint i, uint& e, hashElement& f) const{
+        const packetRecord& r=records[i];
+        f.srcaddr=r.srcaddr;
+        f.dstaddr=r.dstaddr;
+        f.srcport=r.srcport;
+        f.dstport=r.dstport;
+        f.prot=r.prot;
+        f.tos=r.tos;
+        f.tcp_flags=r.tcp_flags;
+        f.vlanId=r.vlanId;
+        f.hashId=r.hashId;
+        if(!r.extended){
+            f.dOctets=r.length;
+            uint64_t us=(uint64_t)base.tv_usec+r.timestamp;
+            f.First.tv_sec=base.tv_sec+us/1000000;
+            f.First.tv_usec=us%1000000;
+            f.ipVersion=4;
+            f.tunnelId=0;
+            memset(f.srcaddr6,0,sizeof(f.srcaddr6));
+            memset(f.dstaddr6,0,sizeof(f.dstaddr6));
+        }else{
+            const packetExtension& x=exts[e++];
+            f.dOctets=x.length;
+            f.First=x.timestamp;
+            f.ipVersion=x.ipVersion;
+            f.tunnelId=x.tunnelId;
+            memcpy(f.srcaddr6,x.srcaddr6,sizeof(f.srcaddr6));
+            memcpy(f.dstaddr6,x.dstaddr6,sizeof(f.dstaddr6));
+        }
+    }
+
+    /**
+     * Removes all the packets.
+     */
+    inline void clear(){
+        n=nExts=0;
+    }
+};
+
+/**
+ * Copies the IPv6 source address of a flow.
+ * \param f The flow.
+ * \param a It will contain the address.
+ */
+inline void getSrcAddr6(const hashElement& f, in6_addr* a){
+    memcpy(a->s6_addr,f.srcaddr6,12);
+    memcpy(a->s6_addr+12,&f.srcaddr,4);
+}
+
+/**
+ * Copies the IPv6 destination address of a flow.
+ * \param f The flow.
+ * \param a It will contain the address.
+ */
+inline void getDstAddr6(const hashElement& f, in6_addr* a){
+    memcpy(a->s6_addr,f.dstaddr6,12);
+    memcpy(a->s6_addr+12,&f.dstaddr,4);
+}
+
 
 /**
  * NetFlow v5 header.
@@ -82,7 +428,7 @@ struct flow_ver5_hdr {
   u_int32_t flow_sequence;           /* Sequence number of total flows seen */
   u_int8_t engine_type;              /* Type of flow switching engine (RP,VIP,etc.)*/
   u_int8_t engine_id;                /* Slot number of the flow switching engine */
-  u_int8_t sampling_interval;
+  u_int16_t sampling_interval;       /* Sampling mode (2 bits) and interval (14 bits) */
 };
 
 
@@ -120,19 +466,174 @@ struct netflow5_record {
   struct flow_ver5_rec flowRecord[MAX_FLOW_NUM];
 };
 
+/**
+ * NetFlow v9 header (used for the IPv6 flows, that NetFlow v5 can't carry).
+ */
+struct flow_ver9_hdr {
+  u_int16_t version;                 /* Current version=9 */
+  u_int16_t count;                   /* The number of records (templates and flows) in PDU. */
+  u_int32_t sysUptime;               /* Current time in msecs since router booted */
+  u_int32_t unix_secs;               /* Current seconds since 0000 UTC 1970 */
+  u_int32_t flow_sequence;           /* Sequence number of the PDUs sent */
+  u_int32_t source_id;               /* Exporter observation domain */
+};
 
 /**
- * Exports the flows.
+ * NetFlow v9 IPv4 flow (described by the template NETFLOW9_TEMPLATE_ID4).
+ */
+struct __attribute__((packed)) flow_ver9_rec4 {
+  u_int32_t srcaddr;     /* IPV4_SRC_ADDR */
+  u_int32_t dstaddr;     /* IPV4_DST_ADDR */
+  u_int32_t dPkts;       /* IN_PKTS */
+  u_int32_t dOctets;     /* IN_BYTES */
+  u_int32_t First;       /* FIRST_SWITCHED */
+  u_int32_t Last;        /* LAST_SWITCHED */
+  u_int16_t srcport;     /* L4_SRC_PORT */
+  u_int16_t dstport;     /* L4_DST_PORT */
+  u_int8_t tcp_flags;    /* TCP_FLAGS */
+  u_int8_t prot;         /* PROTOCOL */
+  u_int8_t tos;          /* SRC_TOS */
+  u_int16_t vlanId;      /* SRC_VLAN */
+};
+
+/**
+ * NetFlow v9 IPv6 flow (described by the template NETFLOW9_TEMPLATE_ID6).
+ */
+struct __attribute__((packed)) flow_ver9_rec6 {
+  u_int8_t srcaddr[16];  /* IPV6_SRC_ADDR */
+  u_int8_t dstaddr[16];  /* IPV6_DST_ADDR */
+  u_int32_t dPkts;       /* IN_PKTS */
+  u_int32_t dOctets;     /* IN_BYTES */
+  u_int32_t First;       /* FIRST_SWITCHED */
+  u_int32_t Last;        /* LAST_SWITCHED */
+  u_int16_t srcport;     /* L4_SRC_PORT */
+  u_int16_t dstport;     /* L4_DST_PORT */
+  u_int8_t tcp_flags;    /* TCP_FLAGS */
+  u_int8_t prot;         /* PROTOCOL */
+  u_int8_t tos;          /* SRC_TOS */
+  u_int16_t vlanId;      /* SRC_VLAN */
+};
+
+/**
+ * IPFIX message header.
+ */
+struct ipfix_hdr {
+  u_int16_t version;                 /* Current version=10 */
+  u_int16_t length;                  /* Length of the message (header included) */
+  u_int32_t exportTime;              /* Seconds since 0000 UTC 1970 */
+  u_int32_t sequenceNumber;          /* Number of data records sent before this message */
+  u_int32_t observationDomainId;     /* Exporter observation domain */
+};
+
+/**
+ * IPFIX IPv4 flow (described by the template NETFLOW9_TEMPLATE_ID4). The counters use the reduced
+ * size encoding, since they are 32 bits wide also in the flows.
+ */
+struct __attribute__((packed)) ipfix_rec4 {
+  u_int32_t srcaddr;     /* sourceIPv4Address */
+  u_int32_t dstaddr;     /* destinationIPv4Address */
+  u_int32_t dPkts;       /* packetDeltaCount */
+  u_int32_t dOctets;     /* octetDeltaCount */
+  u_int64_t First;       /* flowStartMilliseconds */
+  u_int64_t Last;        /* flowEndMilliseconds */
+  u_int16_t srcport;     /* sourceTransportPort */
+  u_int16_t dstport;     /* destinationTransportPort */
+  u_int8_t tcp_flags;    /* tcpControlBits */
+  u_int8_t prot;         /* protocolIdentifier */
+  u_int8_t tos;          /* ipClassOfService */
+  u_int16_t vlanId;      /* vlanId */
+};
+
+/**
+ * IPFIX IPv6 flow (described by the template NETFLOW9_TEMPLATE_ID6).
+ */
+struct __attribute__((packed)) ipfix_rec6 {
+  u_int8_t srcaddr[16];  /* sourceIPv6Address */
+  u_int8_t dstaddr[16];  /* destinationIPv6Address */
+  u_int32_t dPkts;       /* packetDeltaCount */
+  u_int32_t dOctets;     /* octetDeltaCount */
+  u_int64_t First;       /* flowStartMilliseconds */
+  u_int64_t Last;        /* flowEndMilliseconds */
+  u_int16_t srcport;     /* sourceTransportPort */
+  u_int16_t dstport;     /* destinationTransportPort */
+  u_int8_t tcp_flags;    /* tcpControlBits */
+  u_int8_t prot;         /* protocolIdentifier */
+  u_int8_t tos;          /* ipClassOfService */
+  u_int16_t vlanId;      /* vlanId */
+};
+
+
+/**
+ * Exports the flows. The flows are encoded directly in a ring of datagrams, that are sent to the
+ * collector with a single sendmmsg call when EXPORT_BATCH of them are full or when flush() is called.
+ * The IPv4 and the IPv6 flows are encoded in different datagrams, each one with a fixed record layout.
+ * The NetFlow v9 and IPFIX templates are sent in their own datagrams, periodically.
  */
 class Exporter{
 private:
+    /**
+     * Layouts of the records of the datagrams.
+     */
+    enum recordLayout{NETFLOW5_IPV4, NETFLOW9_IPV4, NETFLOW9_IPV6, IPFIX_IPV4, IPFIX_IPV6};
+
     int sock; ///<Socket file descriptor
     struct sockaddr_in addr; ///<Address of the collector
     uint32_t systemStartTime; ///< System start time
+    uint32_t packetSequence; ///< Sequence number of the next NetFlow v9 PDU
+    uint32_t flowSequence; ///< Sequence number of the next NetFlow v5 record
+    uint32_t ipfixSequence; ///< Number of IPFIX data records sent
+    u_int8_t engineId; ///< Identifier of this exporter (NetFlow v5 engine_id, NetFlow v9 source_id and IPFIX observation domain)
+    u_char *buffers; ///< The datagrams (EXPORT_BATCH+2, so one IPv4 and one IPv6 datagram can be filled while EXPORT_BATCH are ready)
+    uint *freeBuffers, ///< Stack of the datagrams not used
+         numFree, ///< Number of datagrams in freeBuffers
+         pending; ///< Number of datagrams ready to be sent
+    uint readyBuffers[EXPORT_BATCH]; ///< The datagrams ready to be sent
+    struct mmsghdr msgs[EXPORT_BATCH]; ///< The messages passed to sendmmsg
+    struct iovec iovs[EXPORT_BATCH]; ///< The payloads of the messages
+    recordLayout layout[2]; ///< The layout of the IPv4 (0) and of the IPv6 (1) flows
+    size_t recordsOffset[2], ///< Offset of the first record in the datagrams of the IPv4 (0) and of the IPv6 (1) flows
+           recordSize[2]; ///< Size of a record of the IPv4 (0) and of the IPv6 (1) flows
+    uint maxRecords[2]; ///< Number of flows in a full datagram of IPv4 (0) and of IPv6 (1) flows
+    int open[2]; ///< The datagram of IPv4 (0) and of IPv6 (1) flows being filled (-1 if none)
+    uint n[2]; ///< Number of flows in the datagrams being filled
+    time_t lastTemplate; ///< Time of the last datagram with the templates (0 if they have never been sent)
+    uint sinceTemplate; ///< Number of datagrams of flows sent after the last datagram with the templates
+
+    /**
+     * Returns a datagram.
+     * \param i The index of the datagram.
+     */
+    inline u_char* getBuffer(uint i){return buffers+(size_t)i*EXPORT_DATAGRAM_SIZE;}
+
+    /**
+     * Writes the headers of a datagram being filled and adds it to the datagrams ready to be sent (preceded by
+     * the templates, if they have to be sent again).
+     * \param k 0 for the datagram of the IPv4 flows, 1 for the datagram of the IPv6 flows.
+     * \param now The current time.
+     */
+    void closeDatagram(uint k, const timeval& now);
+
+    /**
+     * Adds a datagram with the NetFlow v9 or IPFIX templates to the datagrams ready to be sent.
+     * \param now The current time.
+     */
+    void sendTemplates(const timeval& now);
+
+    /**
+     * Adds a datagram to the ones ready to be sent. If they are EXPORT_BATCH they are sent.
+     * \param buffer The index of the datagram.
+     * \param len The length of the datagram.
+     */
+    void enqueue(uint buffer, size_t len);
+
+    /**
+     * Sends the datagrams ready to be sent.
+     */
+    void send();
 public:
 
     /**
-     * Constructor of the exporter.
+     * Constructor of the exporter. The protocol is given by exportFormat.
      * \param collectorAddress The ipv4 address of the collector.
      * \param port The port on which is listening the collector.
      * \param systemStartTime The system start time.
@@ -140,19 +641,27 @@ public:
     Exporter(const char* collectorAddress, ushort port, uint32_t systemStartTime);
 
     /**
-     * Prints the flow in a file.
-     * \param out The file where to print the flow.
-     * \param f The flow to print.
+     * Destructor of the exporter.
+     */
+    ~Exporter();
+
+    /**
+     * Sets the identifier of the exporter, so the collector keeps a separate sequence number for each
+     * exporter (default is 0).
+     * \param id The identifier.
+     */
+    void setEngineId(u_int8_t id);
+
+    /**
+     * Encodes an expired flow in the datagram being filled.
+     * \param f The flow.
      */
-    void printFlow(FILE* out,hashElement& f);
+    void addFlow(const hashElement& f);
 
     /**
-     * Sends the expired flows to the collector.
-     * \param q A queue of expired flows.
-     * \param flowSequence The sequence number of the next record.
-     * \param out A pointer to the file where to print the flows.
+     * Sends to the collector all the flows added (also the ones in datagrams not full).
      */
-    uint sendToCollector(std::queue<hashElement>* q, u_int32_t flowSequence, FILE* out);
+    void flush();
 };
 
 
@@ -181,20 +690,61 @@ inline bool isExpired(hashElement& f, int32_t idle, int32_t lifeTime, time_t* no
 }
 
 /**
- * Fill an hashElement with the information contained in a captured packet.
+ * Walks the datalink header of a packet, skipping the 802.1Q/QinQ tags and the MPLS labels.
+ * Untagged IP packets are recognized with a single comparison.
  * \param pkt The captured packet.
- * \param datalinkOffset The size of a datalink header.
+ * \param datalinkOffset The size of a datalink header (its last two bytes are the ethertype).
+ * \param len The number of captured bytes of the packet.
+ * \param vlanId It will contain the VLAN ID of the innermost tag (0 if the packet is untagged).
+ * \return The offset of the IP (v4 or v6) header or -1 if the packet doesn't contain an IP header.
  */
-inline void getFlow(const unsigned char* pkt, const int datalinkOffset, const uint32_t len, hashElement& f){
-    iphdr* ip=(struct iphdr*) (pkt+datalinkOffset);
-    f.prot=ip->protocol;
-    f.tos=ip->tos;
-    f.srcaddr=ip->saddr;
-    f.dstaddr=ip->daddr;
-    uint32_t ipHdrLen=(ip->ihl&0x0f)*4,payloadOffset;
-    int transportOffset=datalinkOffset+ipHdrLen;
+inline int getNetworkOffset(const unsigned char* pkt, const int datalinkOffset, const uint32_t len, u_int16_t& vlanId){
+    vlanId=0;
+    /**Raw IP.**/
+    if(datalinkOffset==0) return (len!=0 && ((pkt[0]>>4)==4 || (pkt[0]>>4)==6))?0:-1;
+    uint32_t offset=datalinkOffset;
+    if(len<offset) return -1;
+    uint16_t type=(pkt[offset-2]<<8)|pkt[offset-1];
+    if(type==ETHERTYPE_IPV4 || type==ETHERTYPE_IPV6) return offset;
+    for(uint i=0; i<MAX_L2_TAGS; i++){
+        switch(type){
+            case ETHERTYPE_VLAN:
+            case ETHERTYPE_QINQ:
+            case ETHERTYPE_QINQ_OLD:
+                if(len<offset+4) return -1;
+                vlanId=((pkt[offset]<<8)|pkt[offset+1])&0x0fff;
+                type=(pkt[offset+2]<<8)|pkt[offset+3];
+                offset+=4;
+                if(type==ETHERTYPE_IPV4 || type==ETHERTYPE_IPV6) return offset;
+                break;
+            case ETHERTYPE_MPLS:
+            case ETHERTYPE_MPLS_MULTI:
+                /**Skips the labels up to the bottom of the stack, then guesses the payload from the IP version.**/
+                for(; i<MAX_L2_TAGS; i++){
+                    if(len<offset+4) return -1;
+                    offset+=4;
+                    if(pkt[offset-2]&0x1)
+                        return (len>offset && ((pkt[offset]>>4)==4 || (pkt[offset]>>4)==6))?(int)offset:-1;
+                }
+                return -1;
+            default:
+                return -1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Reads the ports and the flags of the transport header of a packet.
+ * \param pkt The captured packet.
+ * \param transportOffset The offset of the transport header.
+ * \param len The number of captured bytes of the packet.
+ * \param f The hashElement that will contain the ports and the flags.
+ */
+inline void getTransport(const unsigned char* pkt, const uint32_t transportOffset, const uint32_t len, hashElement& f){
     uint8_t newflags=0;
-    if(ip->protocol==TCP_PROT_NUM){
+    /**Ports and flags are read only if they have been captured.**/
+    if(f.prot==TCP_PROT_NUM && len>=transportOffset+14){
         tcphdr* tcp=(struct tcphdr*)(pkt+transportOffset);
         f.srcport=tcp->source;
         f.dstport=tcp->dest;
@@ -206,28 +756,256 @@ inline void getFlow(const unsigned char* pkt, const int datalinkOffset, const ui
         newflags|=((tcp->rst&0x1)<<2);
         newflags|=((tcp->syn&0x1)<<1);
         newflags|=(tcp->fin&0x1);
-        payloadOffset=transportOffset+20;
-    }else if(ip->protocol==UDP_PROT_NUM){
+    }else if(f.prot==UDP_PROT_NUM && len>=transportOffset+4){
         udphdr* udp=(struct udphdr*)(pkt+transportOffset);
         f.srcport=udp->source;
         f.dstport=udp->dest;
-        payloadOffset=transportOffset+8;
     }else{
         f.srcport=f.dstport=0;
-        payloadOffset=transportOffset;
     }
     f.tcp_flags=newflags;
 }
 
+/**
+ * Skips the IPv6 extension headers.
+ * \param pkt The captured packet.
+ * \param offset The offset of the first header after the fixed IPv6 header.
+ * \param len The number of captured bytes of the packet.
+ * \param next The Next Header field of the IPv6 header. It will contain the transport protocol.
+ * \return The offset of the transport header, 0 if the packet is not the first fragment (it doesn't contain
+ *         the transport header) or -1 if the transport protocol can't be found.
+ */
+inline int skipIpv6Extensions(const unsigned char* pkt, uint32_t offset, const uint32_t len, uint8_t& next){
+    for(uint i=0; i<MAX_IPV6_EXT_HDRS; i++){
+        switch(next){
+            case IPPROTO_HOPOPTS:
+            case IPPROTO_ROUTING:
+            case IPPROTO_DSTOPTS:
+            case 135: /**Mobility.**/
+                if(len<offset+2) return -1;
+                next=pkt[offset];
+                offset+=(pkt[offset+1]+1)*8;
+                break;
+            case IPPROTO_AH:
+                if(len<offset+2) return -1;
+                next=pkt[offset];
+                offset+=(pkt[offset+1]+2)*4;
+                break;
+            case IPPROTO_FRAGMENT:
+                if(len<offset+8) return -1;
+                next=pkt[offset];
+                /**Only the first fragment contains the transport header.**/
+                if(((pkt[offset+2]<<8)|pkt[offset+3])&0xfff8) return 0;
+                offset+=8;
+                break;
+            default:
+                return offset;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Fills an hashElement with the IPv6 header of a packet, walking the extension headers to find the
+ * transport protocol.
+ * \param pkt The captured packet.
+ * \param networkOffset The offset of the IPv6 header.
+ * \param len The number of captured bytes of the packet.
+ * \param f The hashElement that will contain the flow.
+ * \return False if the packet is too short to contain an IPv6 header.
+ */
+inline bool getFlow6(const unsigned char* pkt, const uint32_t networkOffset, const uint32_t len, hashElement& f){
+    if(len<networkOffset+sizeof(ip6_hdr)) return false;
+    const ip6_hdr* ip=(const ip6_hdr*) (pkt+networkOffset);
+    f.ipVersion=6;
+    f.tos=(ntohl(ip->ip6_flow)>>20)&0xff;
+    memcpy(f.srcaddr6,&ip->ip6_src,12);
+    memcpy(&f.srcaddr,ip->ip6_src.s6_addr+12,4);
+    memcpy(f.dstaddr6,&ip->ip6_dst,12);
+    memcpy(&f.dstaddr,ip->ip6_dst.s6_addr+12,4);
+    uint8_t next=ip->ip6_nxt;
+    int transportOffset=skipIpv6Extensions(pkt,networkOffset+sizeof(ip6_hdr),len,next);
+    /**If the transport protocol is unknown.**/
+    f.prot=(transportOffset<0)?IPPROTO_NONE:next;
+    if(transportOffset>0){
+        getTransport(pkt,transportOffset,len,f);
+    }else{
+        f.srcport=f.dstport=0;
+        f.tcp_flags=0;
+    }
+    return true;
+}
+
+/**
+ * Finds the transport header of a packet (without filling a flow).
+ * \param pkt The captured packet.
+ * \param networkOffset The offset of the IP (v4 or v6) header.
+ * \param len The number of captured bytes of the packet.
+ * \param prot It will contain the transport protocol.
+ * \return The offset of the transport header, 0 if the packet is not the first fragment or -1 if it
+ *         can't be found.
+ */
+inline int getTransportOffset(const unsigned char* pkt, const uint32_t networkOffset, const uint32_t len, uint8_t& prot){
+    if((pkt[networkOffset]>>4)==6){
+        if(len<networkOffset+sizeof(ip6_hdr)) return -1;
+        prot=pkt[networkOffset+6];
+        return skipIpv6Extensions(pkt,networkOffset+sizeof(ip6_hdr),len,prot);
+    }
+    if(len<networkOffset+sizeof(iphdr)) return -1;
+    prot=pkt[networkOffset+9];
+    if(((pkt[networkOffset+6]<<8)|pkt[networkOffset+7])&0x1fff) return 0;
+    return networkOffset+(pkt[networkOffset]&0x0f)*4;
+}
+
+/**
+ * Returns the offset of the IP packet carried by a tunnel.
+ * \param pkt The captured packet.
+ * \param transportOffset The offset of the header following the outer IP header.
+ * \param len The number of captured bytes of the packet.
+ * \param prot The protocol of the header following the outer IP header.
+ * \param tunnelId It will contain the GRE key, the VXLAN VNI or the GTP-U TEID (0 for IP-in-IP).
+ * \return The offset of the inner IP header or -1 if the packet is not a (supported) tunnel.
+ */
+inline int getTunnelPayload(const unsigned char* pkt, uint32_t transportOffset, const uint32_t len, uint8_t prot, u_int32_t& tunnelId){
+    uint32_t offset;
+    u_int16_t innerVlan;
+    switch(prot){
+        case IPIP_PROT_NUM:
+        case IPV6_IN_IP_PROT_NUM:
+            tunnelId=0;
+            offset=transportOffset;
+            break;
+        case GRE_PROT_NUM:{
+            if(len<transportOffset+4) return -1;
+            uint16_t flags=(pkt[transportOffset]<<8)|pkt[transportOffset+1],
+                     type=(pkt[transportOffset+2]<<8)|pkt[transportOffset+3];
+            /**Only version 0 (the enhanced GRE of PPTP carries PPP).**/
+            if(flags&0x7) return -1;
+            offset=transportOffset+4;
+            if(flags&0x8000) offset+=4; /**Checksum.**/
+            tunnelId=0;
+            if(flags&0x2000){ /**Key.**/
+                if(len<offset+4) return -1;
+                tunnelId=(pkt[offset]<<24)|(pkt[offset+1]<<16)|(pkt[offset+2]<<8)|pkt[offset+3];
+                offset+=4;
+            }
+            if(flags&0x1000) offset+=4; /**Sequence number.**/
+            if(type==ETHERTYPE_TEB){
+                if(len<offset+14) return -1;
+                int inner=getNetworkOffset(pkt+offset,14,len-offset,innerVlan);
+                return inner<0?-1:(int)(offset+inner);
+            }
+            if(type!=ETHERTYPE_IPV4 && type!=ETHERTYPE_IPV6) return -1;
+            break;
+        }
+        case UDP_PROT_NUM:{
+            if(len<transportOffset+8) return -1;
+            uint16_t dstport=(pkt[transportOffset+2]<<8)|pkt[transportOffset+3];
+            offset=transportOffset+8;
+            if(dstport==VXLAN_PORT){
+                /**VNI present flag.**/
+                if(len<offset+8+14 || !(pkt[offset]&0x08)) return -1;
+                tunnelId=(pkt[offset+4]<<16)|(pkt[offset+5]<<8)|pkt[offset+6];
+                offset+=8;
+                int inner=getNetworkOffset(pkt+offset,14,len-offset,innerVlan);
+                return inner<0?-1:(int)(offset+inner);
+            }else if(dstport==GTPU_PORT){
+                /**Version 1 G-PDU.**/
+                if(len<offset+8 || (pkt[offset]&0xf0)!=0x30 || pkt[offset+1]!=0xff) return -1;
+                uint8_t flags=pkt[offset];
+                tunnelId=(pkt[offset+4]<<24)|(pkt[offset+5]<<16)|(pkt[offset+6]<<8)|pkt[offset+7];
+                offset+=8;
+                if(flags&0x07){
+                    /**Sequence number, N-PDU number and type of the next extension header.**/
+                    if(len<offset+4) return -1;
+                    uint8_t next=pkt[offset+3];
+                    offset+=4;
+                    for(uint i=0; next && i<MAX_IPV6_EXT_HDRS; i++){
+                        if(len<offset+1 || pkt[offset]==0) return -1;
+                        offset+=pkt[offset]*4;
+                        if(len<offset) return -1;
+                        next=pkt[offset-1];
+                    }
+                    if(next) return -1;
+                }
+            }else{
+                return -1;
+            }
+            break;
+        }
+        default:
+            return -1;
+    }
+    if(len<=offset || ((pkt[offset]>>4)!=4 && (pkt[offset]>>4)!=6)) return -1;
+    return offset;
+}
+
+/**
+ * Skips the tunnels (up to MAX_TUNNEL_DEPTH nested ones) that carry a packet.
+ * \param pkt The captured packet.
+ * \param networkOffset The offset of the outer IP header.
+ * \param len The number of captured bytes of the packet.
+ * \param tunnelId It will contain the identifier of the innermost tunnel (0 if there are no tunnels).
+ * \return The offset of the innermost IP header.
+ */
+inline int decapsulate(const unsigned char* pkt, int networkOffset, const uint32_t len, u_int32_t& tunnelId){
+    tunnelId=0;
+    for(uint depth=0; depth<MAX_TUNNEL_DEPTH; depth++){
+        uint8_t prot;
+        u_int32_t id;
+        int transportOffset=getTransportOffset(pkt,networkOffset,len,prot);
+        if(transportOffset<=0) break;
+        int inner=getTunnelPayload(pkt,transportOffset,len,prot,id);
+        if(inner<0) break;
+        networkOffset=inner;
+        tunnelId=id;
+    }
+    return networkOffset;
+}
+
+/**
+ * Fill an hashElement with the information contained in a captured packet.
+ * \param pkt The captured packet.
+ * \param datalinkOffset The size of a datalink header.
+ * \param len The number of captured bytes of the packet.
+ * \return The offset of the IP header (the innermost one if the tunnels are decapsulated) or -1 if the
+ *         packet is too short to contain an IP header.
+ */
+inline int getFlow(const unsigned char* pkt, const int datalinkOffset, const uint32_t len, hashElement& f){
+    int networkOffset=getNetworkOffset(pkt,datalinkOffset,len,f.vlanId);
+    if(networkOffset<0 || len<=(uint32_t)networkOffset) return -1;
+    f.tunnelId=0;
+    if(decapTunnels)
+        networkOffset=decapsulate(pkt,networkOffset,len,f.tunnelId);
+    if((pkt[networkOffset]>>4)==6)
+        return getFlow6(pkt,networkOffset,len,f)?networkOffset:-1;
+    if(len<networkOffset+sizeof(iphdr)) return -1;
+    iphdr* ip=(struct iphdr*) (pkt+networkOffset);
+    f.ipVersion=4;
+    f.prot=ip->protocol;
+    f.tos=ip->tos;
+    f.srcaddr=ip->saddr;
+    f.dstaddr=ip->daddr;
+    memset(f.srcaddr6,0,sizeof(f.srcaddr6));
+    memset(f.dstaddr6,0,sizeof(f.dstaddr6));
+    uint32_t ipHdrLen=(ip->ihl&0x0f)*4;
+    getTransport(pkt,networkOffset+ipHdrLen,len,f);
+    return networkOffset;
+}
+
 /**
  * Returns true if the flows have the same key (<Tos,Level 4 protocol, Level 4 Source Port, Level 4 Destination Port,
- * Level 3 Source Address, Level 3 Destination Address>)
+ * Level 3 Source Address, Level 3 Destination Address> and the VLAN ID if vlanKeyMask is not 0). The upper
+ * bits of the addresses are compared only for IPv6 flows. Flows carried by different tunnels are different.
  * \param f1 The first flow.
  * \param f2 The second flow.
  */
 inline bool equals(const hashElement& f1, const hashElement& f2){
     return f1.srcaddr==f2.srcaddr && f1.dstaddr==f2.dstaddr && f1.srcport==f2.srcport &&
-            f1.dstport==f2.dstport && f1.prot==f2.prot && f1.tos==f2.tos ;
+            f1.dstport==f2.dstport && f1.prot==f2.prot && f1.tos==f2.tos && f1.ipVersion==f2.ipVersion &&
+            ((f1.vlanId^f2.vlanId)&vlanKeyMask)==0 && f1.tunnelId==f2.tunnelId &&
+            (f1.ipVersion==4 || (memcmp(f1.srcaddr6,f2.srcaddr6,sizeof(f1.srcaddr6))==0 &&
+                                 memcmp(f1.dstaddr6,f2.dstaddr6,sizeof(f1.dstaddr6))==0));
 }
 
 #endif /* FLOW_HPP_ */
@@ -0,0 +1,270 @@
+/*
+ * flowOutput.cpp
+ *
+ * \date 16/10/2026
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * File where the flows are printed in textual format. The exporters give chunks of whole lines
+ * to a dedicated thread, that writes them (compressed with zstd, if required) on a sequence of
+ * segments, rotated by time or by size.
+ */
+
+#include "flowOutput.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+/**
+ * Creates the output and starts its writer thread.
+ * \param path The name of the file.
+ * \param header Line written at the beginning of each segment (NULL if none).
+ * \param rotateTime Seconds after which a segment is closed (0 if the segments are not rotated by time).
+ *                   The segments are aligned to multiples of rotateTime.
+ * \param rotateSize Bytes after which a segment is closed (0 if the segments are not rotated by size).
+ * \param compress True if the segments must be compressed with zstd.
+ */
+FlowOutput::FlowOutput(const char* path, const char* header, uint rotateTime, u_int64_t rotateSize, bool compress):
+                       path(path),header(header),rotateTime(rotateTime),rotateSize(rotateSize),compress(compress),
+                       segment(NULL),segmentEnd(0),segments(0),segmentSize(0),allocated(0),pending(0),closing(false){
+#ifdef HAVE_ZSTD
+    cctx=NULL;
+    zbuffer=NULL;
+    if(compress){
+        cctx=ZSTD_createCCtx();
+        ZSTD_CCtx_setParameter(cctx,ZSTD_c_compressionLevel,OUTPUT_ZSTD_LEVEL);
+        zbufferSize=ZSTD_CStreamOutSize();
+        zbuffer=new char[zbufferSize];
+    }
+#else
+    if(compress){
+        fprintf(stderr,"ffProbe has been compiled without zstd (make ZSTD=1).\n");
+        exit(-1);
+    }
+#endif
+    /**The first segment is opened now, so a wrong path is reported at startup.**/
+    openSegment(time(NULL));
+    if(segment==NULL)
+        exit(-1);
+    pthread_mutex_init(&lock,NULL);
+    pthread_cond_init(&full,NULL);
+    pthread_cond_init(&empty,NULL);
+    /**The writer thread doesn't handle the signals (they are handled by the reader and by the exporter).**/
+    sigset_t set,old;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK,&set,&old);
+    if(pthread_create(&writer,NULL,writeChunks,this)){
+        fprintf(stderr,"Impossible to start the writer of the output.\n");
+        exit(-1);
+    }
+    pthread_sigmask(SIG_SETMASK,&old,NULL);
+}
+
+/**
+ * Writes the chunks given by the exporters, stops the writer thread and closes the segment.
+ */
+FlowOutput::~FlowOutput(){
+    pthread_mutex_lock(&lock);
+    closing=true;
+    pthread_cond_signal(&full);
+    pthread_mutex_unlock(&lock);
+    pthread_join(writer,NULL);
+    closeSegment();
+    for(size_t i=0; i<freeChunks.size(); i++)
+        delete[] freeChunks[i];
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&full);
+    pthread_cond_destroy(&empty);
+#ifdef HAVE_ZSTD
+    if(cctx!=NULL){
+        ZSTD_freeCCtx(cctx);
+        delete[] zbuffer;
+    }
+#endif
+}
+
+/**
+ * Opens a new segment and writes the header.
+ * \param now The current time.
+ */
+void FlowOutput::openSegment(time_t now){
+    char name[4096];
+    const char* suffix=compress?".zst":"";
+    if(rotateTime || rotateSize){
+        char start[32];
+        struct tm t;
+        localtime_r(&now,&t);
+        strftime(start,sizeof(start),"%Y%m%d-%H%M%S",&t);
+        snprintf(name,sizeof(name),"%s.%s.%u%s",path,start,segments,suffix);
+    }else
+        snprintf(name,sizeof(name),"%s%s",path,suffix);
+    ++segments;
+    segmentSize=0;
+    segmentEnd=rotateTime?(now/rotateTime+1)*rotateTime:0;
+    segment=fopen(name,"w");
+    if(segment==NULL){
+        perror("Opening output file");
+        return;
+    }
+    if(header!=NULL)
+        writeSegment(header,strlen(header));
+}
+
+/**
+ * Closes the segment being written.
+ */
+void FlowOutput::closeSegment(){
+    if(segment==NULL)
+        return;
+#ifdef HAVE_ZSTD
+    if(compress){
+        /**Ends the zstd frame, so the segment can be decompressed alone.**/
+        ZSTD_inBuffer in={NULL,0,0};
+        size_t remaining;
+        do{
+            ZSTD_outBuffer out={zbuffer,zbufferSize,0};
+            remaining=ZSTD_compressStream2(cctx,&out,&in,ZSTD_e_end);
+            if(ZSTD_isError(remaining)){
+                fprintf(stderr,"Compression error: %s\n",ZSTD_getErrorName(remaining));
+                break;
+            }
+            fwrite(zbuffer,1,out.pos,segment);
+        }while(remaining!=0);
+    }
+#endif
+    fclose(segment);
+    segment=NULL;
+}
+
+/**
+ * Writes data on the segment (compressed, if required).
+ * \param data The data.
+ * \param len The length of the data.
+ */
+void FlowOutput::writeSegment(const char* data, size_t len){
+#ifdef HAVE_ZSTD
+    if(compress){
+        ZSTD_inBuffer in={data,len,0};
+        while(in.pos<in.size){
+            ZSTD_outBuffer out={zbuffer,zbufferSize,0};
+            size_t r=ZSTD_compressStream2(cctx,&out,&in,ZSTD_e_continue);
+            if(ZSTD_isError(r)){
+                fprintf(stderr,"Compression error: %s\n",ZSTD_getErrorName(r));
+                return;
+            }
+            fwrite(zbuffer,1,out.pos,segment);
+            segmentSize+=out.pos;
+        }
+        return;
+    }
+#endif
+    fwrite(data,1,len,segment);
+    segmentSize+=len;
+}
+
+/**
+ * Body of the writer thread.
+ * \param o The output.
+ */
+void* FlowOutput::writeChunks(void* o){
+    FlowOutput *fo=(FlowOutput*) o;
+    pthread_mutex_lock(&fo->lock);
+    while(true){
+        if(fo->fullChunks.empty()){
+            if(fo->closing)
+                break;
+            /**Wakes up periodically, so the segments are closed on time also if there are no flows.**/
+            timespec deadline;
+            clock_gettime(CLOCK_REALTIME,&deadline);
+            deadline.tv_sec+=OUTPUT_IDLE_WAIT;
+            pthread_cond_timedwait(&fo->full,&fo->lock,&deadline);
+        }
+        chunk c;
+        bool found=!fo->fullChunks.empty();
+        if(found){
+            c=fo->fullChunks.front();
+            fo->fullChunks.pop_front();
+        }
+        /**The exporters can give chunks while this one is compressed and written.**/
+        pthread_mutex_unlock(&fo->lock);
+        time_t now=time(NULL);
+        /**The size of a compressed chunk is not known before compressing it.**/
+        u_int64_t next=(found && !fo->compress)?c.len:0;
+        if(fo->segment!=NULL && ((fo->rotateTime && now>=fo->segmentEnd) ||
+                                 (fo->rotateSize && fo->segmentSize && fo->segmentSize+next>fo->rotateSize)))
+            fo->closeSegment();
+        if(found){
+            if(fo->segment==NULL && (fo->rotateTime || fo->rotateSize))
+                fo->openSegment(now);
+            if(fo->segment!=NULL)
+                fo->writeSegment(c.data,c.len);
+        }
+        pthread_mutex_lock(&fo->lock);
+        if(found){
+            fo->freeChunks.push_back(c.data);
+            --fo->pending;
+            pthread_cond_signal(&fo->empty);
+        }
+    }
+    pthread_mutex_unlock(&fo->lock);
+    return NULL;
+}
+
+/**
+ * Returns an empty chunk of OUTPUT_CHUNK_SIZE bytes. If the writer is slower than the exporters,
+ * waits for a chunk to be written.
+ */
+char* FlowOutput::getChunk(){
+    pthread_mutex_lock(&lock);
+    /**
+     * The chunks are allocated when needed, up to OUTPUT_CHUNKS. Then the exporter waits, unless no chunk
+     * is being written (the others are being filled by the exporters).
+     */
+    while(freeChunks.empty() && allocated>=OUTPUT_CHUNKS && pending>0)
+        pthread_cond_wait(&empty,&lock);
+    char* c;
+    if(freeChunks.empty()){
+        c=new char[OUTPUT_CHUNK_SIZE];
+        ++allocated;
+    }else{
+        c=freeChunks.back();
+        freeChunks.pop_back();
+    }
+    pthread_mutex_unlock(&lock);
+    return c;
+}
+
+/**
+ * Gives a chunk to the writer thread.
+ * \param data The chunk (returned by getChunk), it contains only whole lines.
+ * \param len The number of bytes of the lines.
+ */
+void FlowOutput::write(char* data, size_t len){
+    chunk c;
+    c.data=data;
+    c.len=len;
+    pthread_mutex_lock(&lock);
+    fullChunks.push_back(c);
+    ++pending;
+    pthread_cond_signal(&full);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,143 @@
+/*
+ * flowOutput.hpp
+ *
+ * \date 16/10/2026
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * File where the flows are printed in textual format. The exporters give chunks of whole lines
+ * to a dedicated thread, that writes them (compressed with zstd, if required) on a sequence of
+ * segments, rotated by time or by size.
+ */
+
+#ifndef FLOWOUTPUT_HPP_
+#define FLOWOUTPUT_HPP_
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <ctime>
+#include <deque>
+#include <vector>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define OUTPUT_CHUNK_SIZE (1024*1024) ///<Size of a chunk of lines.
+#define OUTPUT_CHUNKS 32 ///<Number of chunks (the ones being filled and the ones being written included).
+#define OUTPUT_IDLE_WAIT 1 ///<Seconds waited by the writer for a chunk before checking the time of the segment.
+#define OUTPUT_ZSTD_LEVEL 3 ///<zstd compression level.
+
+/**
+ * The file where the flows are printed. If the segments are rotated they are named <path>.<start time>.<n>,
+ * where n counts the segments, and they have the .zst suffix if they are compressed. Each segment starts
+ * with the header of the format.
+ */
+class FlowOutput{
+private:
+    /**
+     * A chunk of lines.
+     */
+    struct chunk{
+        char* data; ///<The lines.
+        size_t len; ///<Number of bytes of the lines.
+    };
+
+    const char* path; ///<The name of the file (without the suffixes).
+    const char* header; ///<Line written at the beginning of each segment (NULL if none).
+    uint rotateTime; ///<Seconds after which a segment is closed (0 if the segments are not rotated by time).
+    u_int64_t rotateSize; ///<Bytes after which a segment is closed (0 if the segments are not rotated by size).
+    bool compress; ///<True if the segments are compressed with zstd.
+    FILE* segment; ///<The segment being written (NULL if none).
+    time_t segmentEnd; ///<Time after which the segment is closed.
+    uint segments; ///<Number of segments opened.
+    u_int64_t segmentSize; ///<Bytes written on the segment.
+    std::vector<char*> freeChunks; ///<The chunks not used.
+    std::deque<chunk> fullChunks; ///<The chunks to be written.
+    uint allocated, ///<Number of chunks allocated.
+         pending; ///<Number of chunks given to the writer and not yet written.
+    bool closing; ///<True when the exporters have terminated.
+    pthread_mutex_t lock; ///<Protects freeChunks, fullChunks and closing.
+    pthread_cond_t full, ///<Signaled when a chunk is given to the writer (or when closing).
+                   empty; ///<Signaled when a chunk has been written.
+    pthread_t writer; ///<The writer thread.
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx* cctx; ///<The zstd compression context.
+    char* zbuffer; ///<The compressed data not yet written.
+    size_t zbufferSize; ///<Size of zbuffer.
+#endif
+
+    /**
+     * Body of the writer thread.
+     * \param o The output.
+     */
+    static void* writeChunks(void* o);
+
+    /**
+     * Opens a new segment and writes the header.
+     * \param now The current time.
+     */
+    void openSegment(time_t now);
+
+    /**
+     * Closes the segment being written.
+     */
+    void closeSegment();
+
+    /**
+     * Writes data on the segment (compressed, if required).
+     * \param data The data.
+     * \param len The length of the data.
+     */
+    void writeSegment(const char* data, size_t len);
+public:
+    /**
+     * Creates the output and starts its writer thread.
+     * \param path The name of the file.
+     * \param header Line written at the beginning of each segment (NULL if none).
+     * \param rotateTime Seconds after which a segment is closed (0 if the segments are not rotated by time).
+     *                   The segments are aligned to multiples of rotateTime.
+     * \param rotateSize Bytes after which a segment is closed (0 if the segments are not rotated by size).
+     * \param compress True if the segments must be compressed with zstd.
+     */
+    FlowOutput(const char* path, const char* header, uint rotateTime, u_int64_t rotateSize, bool compress);
+
+    /**
+     * Writes the chunks given by the exporters, stops the writer thread and closes the segment.
+     */
+    ~FlowOutput();
+
+    /**
+     * Returns an empty chunk of OUTPUT_CHUNK_SIZE bytes. If the writer is slower than the exporters,
+     * waits for a chunk to be written.
+     */
+    char* getChunk();
+
+    /**
+     * Gives a chunk to the writer thread.
+     * \param data The chunk (returned by getChunk), it contains only whole lines.
+     * \param len The number of bytes of the lines.
+     */
+    void write(char* data, size_t len);
+};
+
+#endif /* FLOWOUTPUT_HPP_ */
@@ -0,0 +1,218 @@
+/*
+ * flowPrinter.cpp
+ *
+ * \date 16/10/2026
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * Prints the flows in textual format. The lines are formatted with lookup tables in a chunk of
+ * the output owned by the exporter, that is given to the writer of the output when it is full.
+ */
+
+#include "flowPrinter.hpp"
+
+TextFormat textFormat=TEXT_PIPE;
+
+/**
+ * The numbers from 00 to 99, two digits each.
+ */
+static const char digitPairs[201]=
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/**
+ * The numbers from 0 to 255 in decimal (used for the bytes of the IPv4 addresses).
+ */
+struct octetTable{
+    char text[256][4]; ///<The digits of each number.
+    u_int8_t len[256]; ///<The number of digits of each number.
+
+    octetTable(){
+        for(uint i=0; i<256; i++){
+            len[i]=sprintf(text[i],"%u",i);
+        }
+    }
+};
+
+static const octetTable octets;
+
+/**
+ * Writes a number in decimal.
+ * \param p Where to write the number.
+ * \param v The number.
+ * \return The first byte after the number.
+ */
+static inline char* writeUint(char* p, u_int64_t v){
+    char tmp[20];
+    char* t=tmp+sizeof(tmp);
+    /**Two digits for each division.**/
+    while(v>=100){
+        uint r=(uint)(v%100);
+        v/=100;
+        t-=2;
+        memcpy(t,digitPairs+2*r,2);
+    }
+    if(v>=10){
+        t-=2;
+        memcpy(t,digitPairs+2*v,2);
+    }else
+        *--t='0'+v;
+    size_t len=tmp+sizeof(tmp)-t;
+    memcpy(p,t,len);
+    return p+len;
+}
+
+/**
+ * Writes an IPv4 address in dotted quad notation.
+ * \param p Where to write the address.
+ * \param a The address (in network byte order).
+ * \return The first byte after the address.
+ */
+static inline char* writeIpv4(char* p, u_int32_t a){
+    const u_int8_t* b=(const u_int8_t*) &a;
+    for(uint i=0; i<4; i++){
+        /**The table has a terminator after each number, so 4 bytes can always be copied.**/
+        memcpy(p,octets.text[b[i]],4);
+        p+=octets.len[b[i]];
+        *p++='.';
+    }
+    return p-1;
+}
+
+/**
+ * Writes a string without its terminator.
+ * \param p Where to write the string.
+ * \param s The string (a literal).
+ * \return The first byte after the string.
+ */
+template<size_t N> static inline char* writeString(char* p, const char (&s)[N]){
+    memcpy(p,s,N-1);
+    return p+N-1;
+}
+
+/**
+ * Writes the addresses of a flow.
+ * \param p Where to write the addresses.
+ * \param f The flow.
+ * \param sep The characters between the addresses.
+ * \return The first byte after the destination address.
+ */
+template<size_t N> static inline char* writeAddresses(char* p, const hashElement& f, const char (&sep)[N]){
+    if(f.ipVersion==6){
+        in6_addr a;
+        getSrcAddr6(f,&a);
+        inet_ntop(AF_INET6,&a,p,INET6_ADDRSTRLEN);
+        p+=strlen(p);
+        p=writeString(p,sep);
+        getDstAddr6(f,&a);
+        inet_ntop(AF_INET6,&a,p,INET6_ADDRSTRLEN);
+        return p+strlen(p);
+    }
+    p=writeIpv4(p,f.srcaddr);
+    p=writeString(p,sep);
+    return writeIpv4(p,f.dstaddr);
+}
+
+/**
+ * Constructor of the printer.
+ */
+FlowPrinter::FlowPrinter():buffer(NULL),used(0){;}
+
+/**
+ * Returns the line with the names of the fields (NULL if the format doesn't have it).
+ */
+const char* FlowPrinter::header(){
+    if(textFormat==TEXT_PIPE)
+        return "IPV4_SRC_ADDR|IPV4_DST_ADDR|OUT_PKTS|OUT_BYTES|FIRST_SWITCHED|LAST_SWITCHED|L4_SRC_PORT|L4_DST_PORT|TCP_FLAGS|"
+               "PROTOCOL|SRC_TOS|SRC_VLAN|TUNNEL_ID|\n";
+    return NULL;
+}
+
+/**
+ * Formats a flow in the chunk. The chunk is given to the writer when it is almost full.
+ * \param out The file where to print the flow.
+ * \param f The flow to print.
+ */
+void FlowPrinter::print(FlowOutput* out, const hashElement& f){
+    if(buffer==NULL)
+        buffer=out->getChunk();
+    char* p=buffer+used;
+    if(textFormat==TEXT_PIPE){
+        p=writeAddresses(p,f,"|");
+        *p++='|';
+        p=writeUint(p,f.dPkts); *p++='|';
+        p=writeUint(p,f.dOctets); *p++='|';
+        p=writeUint(p,f.First.tv_sec); *p++='|';
+        p=writeUint(p,f.Last.tv_sec); *p++='|';
+        p=writeUint(p,ntohs(f.srcport)); *p++='|';
+        p=writeUint(p,ntohs(f.dstport)); *p++='|';
+        p=writeUint(p,f.tcp_flags); *p++='|';
+        p=writeUint(p,f.prot); *p++='|';
+        p=writeUint(p,f.tos); *p++='|';
+        p=writeUint(p,f.vlanId); *p++='|';
+        p=writeUint(p,f.tunnelId); *p++='|';
+    }else{
+        p=writeString(p,"{\"srcaddr\":\"");
+        p=writeAddresses(p,f,"\",\"dstaddr\":\"");
+        p=writeString(p,"\",\"dPkts\":");
+        p=writeUint(p,f.dPkts);
+        p=writeString(p,",\"dOctets\":");
+        p=writeUint(p,f.dOctets);
+        p=writeString(p,",\"first\":");
+        p=writeUint(p,f.First.tv_sec);
+        p=writeString(p,",\"last\":");
+        p=writeUint(p,f.Last.tv_sec);
+        p=writeString(p,",\"srcport\":");
+        p=writeUint(p,ntohs(f.srcport));
+        p=writeString(p,",\"dstport\":");
+        p=writeUint(p,ntohs(f.dstport));
+        p=writeString(p,",\"tcp_flags\":");
+        p=writeUint(p,f.tcp_flags);
+        p=writeString(p,",\"prot\":");
+        p=writeUint(p,f.prot);
+        p=writeString(p,",\"tos\":");
+        p=writeUint(p,f.tos);
+        p=writeString(p,",\"vlanId\":");
+        p=writeUint(p,f.vlanId);
+        p=writeString(p,",\"tunnelId\":");
+        p=writeUint(p,f.tunnelId);
+        *p++='}';
+    }
+    *p++='\n';
+    used=p-buffer;
+    if(OUTPUT_CHUNK_SIZE-used<PRINTER_MAX_LINE)
+        flush(out);
+}
+
+/**
+ * Gives the formatted flows to the writer. The chunk contains only whole lines, so the lines of
+ * different printers sharing the same file are not interleaved.
+ * \param out The file.
+ */
+void FlowPrinter::flush(FlowOutput* out){
+    if(buffer!=NULL){
+        out->write(buffer,used);
+        buffer=NULL;
+        used=0;
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * flowPrinter.hpp
+ *
+ * \date 16/10/2026
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * Prints the flows in textual format. The lines are formatted with lookup tables in a chunk of
+ * the output owned by the exporter, that is given to the writer of the output when it is full.
+ */
+
+#ifndef FLOWPRINTER_HPP_
+#define FLOWPRINTER_HPP_
+#include "flow.hpp"
+#include "flowOutput.hpp"
+
+#define PRINTER_MAX_LINE 512 ///<Maximum length of a line (the chunk is given to the writer when it has less free space).
+
+/**
+ * Textual formats of the flows.
+ */
+enum TextFormat{
+    TEXT_PIPE,  ///<One line for each flow, with the fields separated by '|' (the first line has the names of the fields).
+    TEXT_NDJSON ///<One JSON object for each line.
+};
+
+/**
+ * The format of the flows printed on the output file.
+ */
+extern TextFormat textFormat;
+
+/**
+ * Prints the flows of an exporter in textual format (the format is given by textFormat).
+ */
+class FlowPrinter{
+private:
+    char *buffer; ///<The chunk being filled (NULL if none).
+    size_t used; ///<Number of bytes in buffer.
+public:
+    /**
+     * Constructor of the printer.
+     */
+    FlowPrinter();
+
+    /**
+     * Returns the line with the names of the fields (NULL if the format doesn't have it).
+     */
+    static const char* header();
+
+    /**
+     * Formats a flow in the chunk. The chunk is given to the writer when it is almost full.
+     * \param out The file where to print the flow.
+     * \param f The flow to print.
+     */
+    void print(FlowOutput* out, const hashElement& f);
+
+    /**
+     * Gives the formatted flows to the writer. The chunk contains only whole lines, so the lines of
+     * different printers sharing the same file are not interleaved.
+     * \param out The file.
+     */
+    void flush(FlowOutput* out);
+};
+
+#endif /* FLOWPRINTER_HPP_ */
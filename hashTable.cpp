@@ -1,171 +1,526 @@
-/*
- * hashTable.cpp
- *
- * \date 14/mag/2010
- * \author Daniele De Sensi (d.desensi.software@gmail.com)
- * =========================================================================
- *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
- *
- *  This file is part of ffProbe.
- *
- *  ffProbe is free software: you can redistribute it and/or
- *  modify it under the terms of the Lesser GNU General Public
- *  License as published by the Free Software Foundation, either
- *  version 3 of the License, or (at your option) any later version.
-
- *  ffProbe is distributed in the hope that it will be useful,
- *  but WITHOUT ANY WARRANTY; without even the implied warranty of
- *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *  Lesser GNU General Public License for more details.
- *
- *  You should have received a copy of the Lesser GNU General Public
- *  License along with ffProbe.
- *  If not, see <http://www.gnu.org/licenses/>.
- *
- * =========================================================================
- *
- * Implementation of the hash table used by the workers to insert the flows.
- */
-
- #include "hashTable.hpp"
-
-/**
- * Constructor of the hash table.
- * \param d Number of row of the table.
- * \param maxActiveFlows Maximum number of active flows.
- * \param idle Max number of seconds of inactivity.
- * \param lifeTime Max number of life's seconds of a flow.
- */
-Hash::Hash(uint d, uint maxActiveFlows, uint idle, uint lifetime):h(new hashElement*[d]),size(d)
-    ,maxActiveFlows(maxActiveFlows),activeFlows(0),lasti(0),lastj(0),idle(idle),lifetime(lifetime){
-	sizes=new uint[d];
-	capacities=new uint[d];
-	for(uint i=0; i<d; i++){
-		h[i]=(hashElement*)calloc(10,sizeof(hashElement));
-		sizes[i]=0;
-		capacities[i]=10;
-	}
-}
-
-/**
- * Destructor of the hash table.
- */
-Hash::~Hash(){
-    for(uint i=0; i<size; i++)
-        free((void*)h[i]);
-    delete[] h;
-    delete[] sizes;
-    delete[] capacities;
-}
-
-/**
- * Adds (or updates) some flows. If the hash table has the max number of active flows, adds to l a flow and remove it from
- * the hash table.
- * \param flowsToAdd A list of flows to add.
- * \param l A pointer to a list of expired flows.
- */
-void Hash::updateFlows(ff::squeue<hashElement>* flowsToAdd, ff::squeue<hashElement>* l){
-    hashElement f;
-    uint i,x,newcapacity,prefetch_id;
-    f.First.tv_sec=0;
-    while(flowsToAdd->size()!=0){
-        f=flowsToAdd->front();
-        flowsToAdd->pop_front();
-        i=f.hashId%size;
-/**
-* To speed up the execution we can prefetch the collision list in which the next flow will be stored.
-* In general this list will not be the one successive to the current one. For this reason we need to prefetch it explicitly.
-*/
-#ifdef __GNUC__
-        if(flowsToAdd->size()){
-            prefetch_id=(flowsToAdd->front()).hashId;
-            __builtin_prefetch(h[prefetch_id], 1, 0);
-            __builtin_prefetch(&sizes[prefetch_id], 1, 0);
-            __builtin_prefetch(&capacities[prefetch_id], 1, 0);
-        }
-#endif
-        /**Searches the node.**/
-        x=0;
-        while(x<sizes[i] && !equals(h[i][x],f)) ++x;
-        /**Updates flow.**/
-        if(x<sizes[i]){
-            ++(h[i][x].dPkts);
-            h[i][x].dOctets+=f.dOctets;
-            h[i][x].Last=f.First;
-            h[i][x].tcp_flags|=f.tcp_flags;
-          }else{
-            /**Creates new flow and inserts it in the list.**/
-            f.Last=f.First;
-            f.dPkts=1;
-            ++sizes[i];
-            if(sizes[i]>capacities[i]){
-                newcapacity=capacities[i]*2;
-                h[i]=(hashElement*)realloc(h[i],newcapacity*sizeof(hashElement));
-                memset(h[i]+sizes[i]-1,0,capacities[i]*sizeof(hashElement));
-                capacities[i]=newcapacity;
-            }
-            h[i][sizes[i]-1]=f;
-            ++activeFlows;
-            if(activeFlows==maxActiveFlows)
-                checkExpiration(-1,l,NULL);
-        }
-    }
-}
-
-/**
- * Checks if some flow is expired (max for n flows). Start from the last flow checked.
- * \return A vector of expired flows.
- * \param n Maximum number of flow to check.
- * \param l A pointer to the list where to add the expired flows.
- * \param now A pointer to current time value.
- */
-void Hash::checkExpiration(int n, ff::squeue<hashElement>* l, time_t* now){
-    if(n==0) return;
-    uint nodeChecked=0,lineChecked=0,limit,newcapacity;
-    /**If n<=-1 checks all flows in the hash table.**/
-    if(n<=-1)
-      limit=std::numeric_limits<uint>::max();
-    else
-      limit=n;
-    hashElement *line=h[lasti];
-    while(nodeChecked<limit && lineChecked<=size){
-        if(lastj!=sizes[lasti]){
-            ++nodeChecked;
-            /**If the flow is expired, adds the flow to the vector.**/
-            if(isExpired(line[lastj],idle,lifetime,now)){
-                l->push_back(line[lastj]);
-                --activeFlows;
-                std::swap(line[lastj],line[sizes[lasti]-1]);
-                memset(h[lasti]+sizes[lasti]-1,0,sizeof(hashElement));
-                --sizes[lasti];
-                newcapacity=capacities[lasti]/2;
-                if(sizes[lasti]<newcapacity && newcapacity>=10){
-                    h[lasti]=(hashElement*) realloc(h[lasti],newcapacity*sizeof(hashElement));
-                    line=h[lasti];
-                    capacities[lasti]=newcapacity;
-                }
-            }else
-                ++lastj;
-        /**If the end of the row is arrived, checks the next row.**/
-        }else{
-            ++lineChecked;
-            lasti=(lasti+1) % size;
-            line=h[lasti];
-            lastj=0;
-        }
-    }
-}
-
-/**
- * Flush the hash table and insert the flows in the queue.
- * \param flowsToExport The queue in which the flows will be inserted.
- */
-
-void Hash::flush(ff::squeue<hashElement> *flowsToExport){
-    checkExpiration(-1,flowsToExport,NULL);
-}
-
-uint Hash::getActiveFlows(){
-    return activeFlows;
-}
-
+/*
+ * hashTable.cpp
+ *
+ * \date 14/mag/2010
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * Implementation of the hash table used by the workers to insert the flows.
+ */
+
+ #include "hashTable.hpp"
+
+bool symmetricHash=false;
+
+/**
+ * Constructor of the hash table.
+ * \param d Number of row of the table (rounded up to a power of two).
+ * \param maxActiveFlows Maximum number of active flows.
+ * \param evictFlows Number of flows evicted (the next ones checked for the expiration) when the table has
+ *                   maxActiveFlows flows.
+ * \param idle Max number of seconds of inactivity.
+ * \param lifeTime Max number of life's seconds of a flow.
+ */
+Hash::Hash(uint d, uint maxActiveFlows, uint evictFlows, uint idle, uint lifetime):maxActiveFlows(maxActiveFlows),
+    evictFlows(evictFlows),activeFlows(0),lasti(0),lastj(0),idle(idle),lifetime(lifetime){
+	for(size=1; size<d; size<<=1);
+	mask=size-1;
+	d=size;
+	h=new hashElement*[d];
+	sizes=new uint[d];
+	capacities=new uint[d];
+	/**A list is at most twice its flows (or HASH_MIN_CAPACITY). If the arena is exhausted the slab uses malloc.**/
+	slab=new Slab(((size_t)maxActiveFlows*2+(size_t)d*HASH_MIN_CAPACITY)*sizeof(hashElement),
+	              HASH_MIN_CAPACITY*sizeof(hashElement));
+	for(uint i=0; i<d; i++){
+		h[i]=(hashElement*)slab->get(0);
+		memset(h[i],0,HASH_MIN_CAPACITY*sizeof(hashElement));
+		sizes[i]=0;
+		capacities[i]=HASH_MIN_CAPACITY;
+	}
+}
+
+/**
+ * Destructor of the hash table.
+ */
+Hash::~Hash(){
+    for(uint i=0; i<size; i++)
+        slab->put(h[i],__builtin_ctz(capacities[i]/HASH_MIN_CAPACITY));
+    delete slab;
+    delete[] h;
+    delete[] sizes;
+    delete[] capacities;
+}
+
+/**
+ * Changes the capacity of a collision list.
+ * \param i The row of the list.
+ * \param newcapacity The new capacity (HASH_MIN_CAPACITY multiplied by a power of two).
+ */
+void Hash::resize(uint i, uint newcapacity){
+    hashElement* l=(hashElement*)slab->get(__builtin_ctz(newcapacity/HASH_MIN_CAPACITY));
+    memcpy(l,h[i],std::min(capacities[i],newcapacity)*sizeof(hashElement));
+    slab->put(h[i],__builtin_ctz(capacities[i]/HASH_MIN_CAPACITY));
+    h[i]=l;
+    capacities[i]=newcapacity;
+}
+
+/**
+ * Adds (or updates) some flows. If the hash table has the max number of active flows, adds to l
+ * evictFlows flows and removes them from the hash table.
+ * \param packets The packets whose flows must be added (they are removed).
+ * \param l A pointer to a list of expired flows.
+ */
+void Hash::updateFlows(packetRecords* packets, flowQueue* l){
+    hashElement f;
+    uint i,x,newcapacity,prefetch_id,e=0,n=packets->size();
+    f.First.tv_sec=0;
+    for(uint k=0; k<n; k++){
+        packets->get(k,e,f);
+        i=f.hashId&mask;
+/**
+* To speed up the execution we can prefetch the collision list in which the next flow will be stored.
+* In general this list will not be the one successive to the current one. For this reason we need to prefetch it explicitly.
+*/
+#ifdef __GNUC__
+        if(k+1<n){
+            prefetch_id=packets->getHashId(k+1)&mask;
+            __builtin_prefetch(h[prefetch_id], 1, 0);
+            __builtin_prefetch(&sizes[prefetch_id], 1, 0);
+            __builtin_prefetch(&capacities[prefetch_id], 1, 0);
+        }
+#endif
+        /**Searches the node.**/
+        x=0;
+        while(x<sizes[i] && !equals(h[i][x],f)) ++x;
+        /**Updates flow.**/
+        if(x<sizes[i]){
+            ++(h[i][x].dPkts);
+            h[i][x].dOctets+=f.dOctets;
+            h[i][x].Last=f.First;
+            h[i][x].tcp_flags|=f.tcp_flags;
+          }else{
+            /**Creates new flow and inserts it in the list.**/
+            f.Last=f.First;
+            f.dPkts=1;
+            ++sizes[i];
+            if(sizes[i]>capacities[i]){
+                newcapacity=capacities[i]*2;
+                resize(i,newcapacity);
+                memset(h[i]+sizes[i]-1,0,(newcapacity-sizes[i]+1)*sizeof(hashElement));
+            }
+            h[i][sizes[i]-1]=f;
+            ++activeFlows;
+            /**Evicts the next flows checked for the expiration, so the whole table is not flushed.**/
+            if(activeFlows==maxActiveFlows)
+                checkExpiration(evictFlows,l,NULL);
+        }
+    }
+    packets->clear();
+}
+
+/**
+ * Checks if some flow is expired (max for n flows). Start from the last flow checked.
+ * \return A vector of expired flows.
+ * \param n Maximum number of flow to check.
+ * \param l A pointer to the list where to add the expired flows.
+ * \param now A pointer to current time value.
+ */
+void Hash::checkExpiration(int n, flowQueue* l, time_t* now){
+    if(n==0) return;
+    uint nodeChecked=0,lineChecked=0,limit,newcapacity;
+    /**If n<=-1 checks all flows in the hash table.**/
+    if(n<=-1)
+      limit=std::numeric_limits<uint>::max();
+    else
+      limit=n;
+    hashElement *line=h[lasti];
+    while(nodeChecked<limit && lineChecked<=size){
+        if(lastj!=sizes[lasti]){
+            ++nodeChecked;
+            /**If the flow is expired, adds the flow to the vector.**/
+            if(isExpired(line[lastj],idle,lifetime,now)){
+                l->push_back(line[lastj]);
+                --activeFlows;
+                std::swap(line[lastj],line[sizes[lasti]-1]);
+                memset(h[lasti]+sizes[lasti]-1,0,sizeof(hashElement));
+                --sizes[lasti];
+                newcapacity=capacities[lasti]/2;
+                if(sizes[lasti]<newcapacity && newcapacity>=HASH_MIN_CAPACITY){
+                    resize(lasti,newcapacity);
+                    line=h[lasti];
+                }
+            }else
+                ++lastj;
+        /**If the end of the row is arrived, checks the next row.**/
+        }else{
+            ++lineChecked;
+            lasti=(lasti+1) % size;
+            line=h[lasti];
+            lastj=0;
+        }
+    }
+}
+
+/**
+ * Flush the hash table and insert the flows in the queue.
+ * \param flowsToExport The queue in which the flows will be inserted.
+ */
+
+void Hash::flush(flowQueue *flowsToExport){
+    checkExpiration(-1,flowsToExport,NULL);
+}
+
+uint Hash::getActiveFlows(){
+    return activeFlows;
+}
+
+
+/**
+ * Constructor of the flat table.
+ * \param d Initial number of slots (rounded up to a power of two). The table grows up to the slots
+ *          needed for maxActiveFlows flows.
+ * \param maxActiveFlows Maximum number of active flows.
+ * \param evictFlows Number of flows evicted (the ones with the nearest deadlines) when the table has
+ *                   maxActiveFlows flows.
+ * \param idle Max number of seconds of inactivity.
+ * \param lifeTime Max number of life's seconds of a flow.
+ */
+FlatHash::FlatHash(uint d, uint maxActiveFlows, uint evictFlows, uint idle, uint lifetime):ctrl(NULL),keys(NULL),counters(NULL),
+    last(NULL),cold(NULL),arena(NULL),links(NULL),wheelTime(0),maxActiveFlows(maxActiveFlows),evictFlows(evictFlows),activeFlows(0),
+    idle(idle),lifetime(lifetime){
+    /**
+     * A deadline is at most max(idle,lifetime)+1 seconds after the current time and checkExpiration can be
+     * late of half wheel before walking the whole wheel.
+     */
+    for(wheelSize=2; wheelSize<2*(std::max(idle,lifetime)+2); wheelSize<<=1);
+    /**
+     * At most 7/8 of the slots are used (flows and deleted ones) and the flows fill at most 7/8 of them,
+     * so a full table can still delete many flows before being rehashed.
+     */
+    uint64_t needed=(uint64_t)maxActiveFlows*64/49+1;
+    for(maxCapacity=FLAT_GROUP; maxCapacity<needed && maxCapacity<(1u<<31); maxCapacity<<=1);
+    uint c;
+    for(c=FLAT_GROUP; c<d && c<maxCapacity; c<<=1);
+    /**The memory on huge pages is locked, so the table is allocated only once.**/
+    allocate(useHugePages?maxCapacity:c);
+}
+
+/**
+ * Destructor of the flat table.
+ */
+FlatHash::~FlatHash(){
+    release();
+}
+
+/**
+ * Allocates the table.
+ * \param c Number of slots.
+ */
+void FlatHash::allocate(uint c){
+    capacity=c;
+    groupMask=c/FLAT_GROUP-1;
+    usedSlots=0;
+    /**All the columns are in the same arena (each one is aligned to a cache line).**/
+    arena=new Arena((size_t)c*(1+sizeof(flatKey)+sizeof(flatCounters)+sizeof(struct timeval)+sizeof(flatCold)+
+                               sizeof(flatLink))+(size_t)wheelSize*sizeof(flatLink)+6*64);
+    ctrl=(int8_t*)arena->allocate(c);
+    keys=(flatKey*)arena->allocate((size_t)c*sizeof(flatKey));
+    counters=(flatCounters*)arena->allocate((size_t)c*sizeof(flatCounters));
+    last=(struct timeval*)arena->allocate((size_t)c*sizeof(struct timeval));
+    cold=(flatCold*)arena->allocate((size_t)c*sizeof(flatCold));
+    links=(flatLink*)arena->allocate(((size_t)c+wheelSize)*sizeof(flatLink));
+    memset(ctrl,FLAT_EMPTY,c);
+    resetWheel();
+}
+
+/**
+ * Empties the buckets of the wheel.
+ */
+void FlatHash::resetWheel(){
+    for(uint b=capacity; b<capacity+wheelSize; b++)
+        links[b].prev=links[b].next=b;
+}
+
+/**
+ * Releases the columns of the table.
+ */
+void FlatHash::release(){
+    delete arena;
+}
+
+/**
+ * Rebuilds the table removing the deleted slots (doubling it if it is at least half full).
+ */
+void FlatHash::rehash(){
+    /**The old columns are kept until their flows have been moved to the new ones.**/
+    Arena *oldArena=arena;
+    const int8_t *oldCtrl=ctrl;
+    const flatKey *oldKeys=keys;
+    const flatCounters *oldCounters=counters;
+    const struct timeval *oldLast=last;
+    const flatCold *oldCold=cold;
+    uint oldCapacity=capacity;
+    hashElement f;
+    uint freeSlot;
+    allocate((activeFlows>=capacity/2 && capacity<maxCapacity)?capacity*2:capacity);
+    for(uint i=0; i<oldCapacity; i++){
+        if(oldCtrl[i]<0) continue;
+        load(oldKeys[i],oldCounters[i],oldLast[i],oldCold[i],f);
+        f.hashId=hashFun(f);
+        find(f,&freeSlot);
+        ctrl[freeSlot]=oldCtrl[i];
+        store(freeSlot,f);
+        schedule(freeSlot,deadline(freeSlot));
+        ++usedSlots;
+    }
+    delete oldArena;
+}
+
+/**
+ * Stores a new flow in a slot.
+ * \param i The slot.
+ * \param f The flow.
+ */
+void FlatHash::store(uint i, const hashElement& f){
+    flatKey& k=keys[i];
+    k.srcaddr=f.srcaddr;
+    k.dstaddr=f.dstaddr;
+    k.srcport=f.srcport;
+    k.dstport=f.dstport;
+    k.prot=f.prot;
+    k.tos=f.tos;
+    k.ipVersion=f.ipVersion;
+    k.vlanId=f.vlanId;
+    k.tunnelId=f.tunnelId;
+    counters[i].dPkts=f.dPkts;
+    counters[i].dOctets=f.dOctets;
+    counters[i].tcp_flags=f.tcp_flags;
+    last[i]=f.Last;
+    cold[i].First=f.First;
+    memcpy(cold[i].srcaddr6,f.srcaddr6,sizeof(f.srcaddr6));
+    memcpy(cold[i].dstaddr6,f.dstaddr6,sizeof(f.dstaddr6));
+}
+
+/**
+ * Rebuilds the record of a flow from its columns.
+ * \param k The key of the flow.
+ * \param c The counters of the flow.
+ * \param l The Last timestamp of the flow.
+ * \param d The cold data of the flow.
+ * \param f It will contain the flow.
+ */
+void FlatHash::load(const flatKey& k, const flatCounters& c, const struct timeval& l, const flatCold& d,
+                    hashElement& f){
+    f.srcaddr=k.srcaddr;
+    f.dstaddr=k.dstaddr;
+    f.srcport=k.srcport;
+    f.dstport=k.dstport;
+    f.prot=k.prot;
+    f.tos=k.tos;
+    f.ipVersion=k.ipVersion;
+    f.vlanId=k.vlanId;
+    f.tunnelId=k.tunnelId;
+    f.dPkts=c.dPkts;
+    f.dOctets=c.dOctets;
+    f.tcp_flags=c.tcp_flags;
+    f.Last=l;
+    f.First=d.First;
+    memcpy(f.srcaddr6,d.srcaddr6,sizeof(f.srcaddr6));
+    memcpy(f.dstaddr6,d.dstaddr6,sizeof(f.dstaddr6));
+    f.hashId=0;
+}
+
+/**
+ * Removes a flow from the table.
+ * \param i The slot of the flow.
+ */
+void FlatHash::erase(uint i){
+    unlink(i);
+    clearSlot(i);
+}
+
+/**
+ * Frees the slot of a flow, without removing it from the wheel.
+ * \param i The slot of the flow.
+ */
+void FlatHash::clearSlot(uint i){
+    /**If the group has an empty slot no probe sequence goes beyond it, so the slot can become empty.**/
+    if(match(ctrl+(i&~(FLAT_GROUP-1)),FLAT_EMPTY)){
+        ctrl[i]=FLAT_EMPTY;
+        --usedSlots;
+    }else
+        ctrl[i]=FLAT_DELETED;
+    --activeFlows;
+}
+
+/**
+ * Adds (or updates) some flows. If the table has the max number of active flows, adds to l
+ * evictFlows flows and removes them from the table.
+ * \param packets The packets whose flows must be added (they are removed).
+ * \param l A pointer to a list of expired flows.
+ */
+void FlatHash::updateFlows(packetRecords* packets, flowQueue* l){
+    hashElement f;
+    uint i,freeSlot,e=0,n=packets->size();
+    for(uint k=0; k<n; k++){
+        packets->get(k,e,f);
+#ifdef __GNUC__
+        /**Prefetches the first group probed by the next flow.**/
+        if(k+1<n){
+            uint g=packets->getHashId(k+1)&groupMask;
+            __builtin_prefetch(ctrl+g*FLAT_GROUP, 0, 0);
+            __builtin_prefetch(keys+g*FLAT_GROUP, 0, 0);
+        }
+#endif
+        if(usedSlots>=capacity/8*7)
+            rehash();
+        i=find(f,&freeSlot);
+        /**Updates flow.**/
+        if(i!=capacity){
+            flatCounters& c=counters[i];
+            ++(c.dPkts);
+            c.dOctets+=f.dOctets;
+            last[i]=f.First;
+            /**The deadline can only be postponed, except when FIN or RST arrive.**/
+            if((f.tcp_flags&0x5)!=0x0 && (c.tcp_flags&0x5)==0x0){
+                unlink(i);
+                schedule(i,0);
+            }
+            c.tcp_flags|=f.tcp_flags;
+        }else{
+            /**Creates new flow and inserts it in the first free slot.**/
+            f.Last=f.First;
+            f.dPkts=1;
+            if(ctrl[freeSlot]==FLAT_EMPTY)
+                ++usedSlots;
+            ctrl[freeSlot]=fingerprint(f.hashId);
+            store(freeSlot,f);
+            if(wheelTime==0) wheelTime=f.First.tv_sec;
+            schedule(freeSlot,deadline(freeSlot));
+            ++activeFlows;
+            if(activeFlows==maxActiveFlows)
+                evict(evictFlows,l);
+        }
+    }
+    packets->clear();
+}
+
+/**
+ * Exports and removes the flows with the nearest deadlines (the least recently updated ones, if they are
+ * far from the end of their lifetime).
+ * \param n Number of flows to remove.
+ * \param l A pointer to the list where to add the removed flows.
+ */
+void FlatHash::evict(uint n, flowQueue* l){
+    hashElement f;
+    for(uint k=0; n && activeFlows && k<wheelSize;){
+        uint b=capacity+((wheelTime+k)&(wheelSize-1)),i=links[b].next;
+        if(i==b){
+            ++k;
+            continue;
+        }
+        time_t d=deadline(i);
+        unlink(i);
+        /**The flows updated after they have been put in this bucket are moved to the bucket of their deadline.**/
+        if(d>wheelTime+k && k<wheelSize-1){
+            schedule(i,d);
+            continue;
+        }
+        load(keys[i],counters[i],last[i],cold[i],f);
+        l->push_back(f);
+        clearSlot(i);
+        --n;
+    }
+}
+
+/**
+ * Exports the expired flows of the buckets of the wheel up to the current time.
+ * \param n Ignored (the flows are checked only when their deadlines are reached).
+ * \param l A pointer to the list where to add the expired flows.
+ * \param now A pointer to current time value. If it is NULL all the flows are expired.
+ */
+void FlatHash::checkExpiration(int n, flowQueue* l, time_t* now){
+    hashElement f;
+    if(now==NULL){
+        for(uint i=0; i<capacity; i++){
+            if(ctrl[i]<0) continue;
+            load(keys[i],counters[i],last[i],cold[i],f);
+            l->push_back(f);
+        }
+        memset(ctrl,FLAT_EMPTY,capacity);
+        usedSlots=activeFlows=0;
+        resetWheel();
+        return;
+    }
+    if(wheelTime==0 || *now<wheelTime) return;
+    /**If it is too late the whole wheel is checked and the flows are moved relatively to the current time.**/
+    bool all=(*now-wheelTime>=wheelSize/2);
+    uint buckets=all?wheelSize:*now-wheelTime+1;
+    if(all) wheelTime=*now+1;
+    for(uint k=0; k<buckets; k++){
+        uint b=capacity+((all?k:wheelTime)&(wheelSize-1)),i=links[b].next,nxt;
+        /**The bucket is detached, so the flows not expired can be moved to any bucket (also to this one).**/
+        links[b].prev=links[b].next=b;
+        for(; i!=b; i=nxt){
+            nxt=links[i].next;
+            time_t d=deadline(i);
+            if(d<=*now){
+                load(keys[i],counters[i],last[i],cold[i],f);
+                l->push_back(f);
+                clearSlot(i);
+            }else
+                schedule(i,d);
+        }
+        if(!all) ++wheelTime;
+    }
+}
+
+/**
+ * Flush the table and insert the flows in the queue.
+ * \param flowsToExport The queue in which the flows will be inserted.
+ */
+void FlatHash::flush(flowQueue *flowsToExport){
+    checkExpiration(-1,flowsToExport,NULL);
+}
+
+uint FlatHash::getActiveFlows(){
+    return activeFlows;
+}
+
+/**
+ * Creates a table of flows.
+ * \param type The type of the table ("chained" or "flat"). If it is NULL the table is "flat".
+ * \param d Number of rows (slots for the flat table) of the table.
+ * \param maxActiveFlows Maximum number of active flows.
+ * \param evictFlows Number of flows evicted when the table has maxActiveFlows flows.
+ * \param idle Max number of seconds of inactivity.
+ * \param lifeTime Max number of life's seconds of a flow.
+ * \return The table or NULL if the type is unknown.
+ */
+FlowTable* createFlowTable(const char* type, uint d, uint maxActiveFlows, uint evictFlows, uint idle, uint lifetime){
+    if(type==NULL || strcmp(type,"flat")==0)
+        return new FlatHash(d,maxActiveFlows,evictFlows,idle,lifetime);
+    if(strcmp(type,"chained")==0)
+        return new Hash(d,maxActiveFlows,evictFlows,idle,lifetime);
+    return NULL;
+}
@@ -32,34 +32,112 @@
 #include <cassert>
 #include <limits>
 #include <algorithm>
-#include <ff/squeue.hpp>
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "flow.hpp"
+#include "arena.hpp"
 
 /**
- * Hash table
+ * Seed of the hash function.
  */
-class Hash{
+#define HASH_SEED 0x2f6b1e3du
+
+/**
+ * True if the two directions of a flow have the same hash (and so they are managed by the same worker).
+ */
+extern bool symmetricHash;
+
+/**
+ * Initial (and minimum) capacity of a collision list of the chained table.
+ */
+#define HASH_MIN_CAPACITY 10
+
+/**
+ * Number of slots of a group of the flat table (their control bytes are compared with a single SSE2 instruction).
+ */
+#define FLAT_GROUP 16
+
+/**
+ * Control bytes of the free slots of the flat table (the slots containing a flow store its 7 bits fingerprint).
+ */
+#define FLAT_EMPTY ((int8_t)-128)
+#define FLAT_DELETED ((int8_t)-2)
+
+/**
+ * A table of flows.
+ */
+class FlowTable{
+public:
+    virtual ~FlowTable(){;}
+
+    /**
+     * Adds (or updates) some flows. If the table has the max number of active flows, adds to l
+     * evictFlows flows and removes them from the table.
+     * \param packets The packets whose flows must be added (they are removed).
+     * \param l A pointer to a list of expired flows.
+     */
+    virtual void updateFlows(packetRecords* packets, flowQueue* l)=0;
+
+    /**
+     * Checks if some flow is expired (max for n flows). Start from the last flow checked.
+     * \param n Maximum number of flow to check (ignored by the tables that keep the deadlines of the flows).
+     * \param l A pointer to the list where to add the expired flows.
+     * \param now A pointer to current time value. If it is NULL all the flows are expired.
+     */
+    virtual void checkExpiration(int n, flowQueue* l, time_t* now)=0;
+
+    /**
+     * Flush the table and insert the flows in the queue.
+     * \param flowsToExport The queue in which the flows will be inserted.
+     */
+    virtual void flush(flowQueue *flowsToExport)=0;
+
+    virtual uint getActiveFlows()=0;
+};
+
+/**
+ * Hash table with a collision list (an array) for each row.
+ */
+class Hash: public FlowTable{
 private:
     hashElement **h;      ///<The hash table.
+    Slab *slab;           ///<The memory of the collision lists.
     uint *sizes, ///<Sizes of the collision lists.
          *capacities; ///<<Capacities of the collision lists.
-    uint size,            ///<Number of row of the table.
+    uint size,            ///<Number of row of the table (a power of two).
+        mask,             ///<size-1, selects the row of a flow from its hash.
         maxActiveFlows,   ///<Max number of active flows.
+        evictFlows,       ///<Number of flows evicted when the table has the max number of active flows.
         activeFlows,      ///<Number of active flows.
         lasti,      ///<Used to check the expiration of the flows.
         lastj,               ///<Pointers to the last node checked.
         idle,              ///<Max number of seconds of inactivity.
         lifetime;         ///<Max number of life's seconds of a flow.
+
+    /**
+     * Changes the capacity of a collision list.
+     * \param i The row of the list.
+     * \param newcapacity The new capacity (HASH_MIN_CAPACITY multiplied by a power of two).
+     */
+    void resize(uint i, uint newcapacity);
 public:
     /**
      * Constructor of the hash table.
-     * \param d Number of row of the table.
+     * \param d Number of row of the table (rounded up to a power of two).
      * \param maxActiveFlows Maximum number of active flows.
+     * \param evictFlows Number of flows evicted (the next ones checked for the expiration) when the table has
+     *                   maxActiveFlows flows.
      * \param idle Max number of seconds of inactivity.
      * \param lifeTime Max number of life's seconds of a flow.
      */
-    Hash(uint d, uint maxActiveFlows, uint idle, uint lifetime);
+    Hash(uint d, uint maxActiveFlows, uint evictFlows, uint idle, uint lifetime);
 
     /**
      * Destructor of the hash table.
@@ -67,12 +145,12 @@ public:
     ~Hash();
 
     /**
-     * Adds (or updates) some flows. If the hash table has the max number of active flows, adds to l a flow and remove it from
-     * the hash table.
-     * \param flowsToAdd A list of flows to add.
+     * Adds (or updates) some flows. If the hash table has the max number of active flows, adds to l
+     * evictFlows flows and removes them from the hash table.
+     * \param packets The packets whose flows must be added (they are removed).
      * \param l A pointer to a list of expired flows.
      */
-    void updateFlows(ff::squeue<hashElement>* flowsToAdd, ff::squeue<hashElement>* l);
+    void updateFlows(packetRecords* packets, flowQueue* l);
 
     /**
      * Checks if some flow is expired (max for n flows). Start from the last flow checked.
@@ -81,27 +159,354 @@ public:
      * \param l A pointer to the list where to add the expired flows.
      * \param now A pointer to current time value.
      */
-    void checkExpiration(int n, ff::squeue<hashElement>* l, time_t* now);
+    void checkExpiration(int n, flowQueue* l, time_t* now);
 
     /**
      * Flush the hash table and insert the flows in the queue.
      * \param flowsToExport The queue in which the flows will be inserted.
      */
 
-    void flush(ff::squeue<hashElement> *flowsToExport);
+    void flush(flowQueue *flowsToExport);
+
+    uint getActiveFlows();
+};
+
+
+/**
+ * Key of a flow in the flat table (the fields compared by a lookup, except the high bits of the IPv6
+ * addresses). It is aligned to 32 bytes so that a key never spans two cache lines.
+ */
+typedef struct flatKey{
+    u_int32_t srcaddr, dstaddr;
+    u_int16_t srcport, dstport;
+    u_int8_t prot, tos, ipVersion;
+    u_int16_t vlanId;
+    u_int32_t tunnelId;
+}__attribute__((aligned(32))) flatKey;
+
+/**
+ * Counters of a flow in the flat table (updated by each packet of the flow).
+ */
+typedef struct flatCounters{
+    u_int32_t dPkts, dOctets;
+    u_int8_t tcp_flags;
+}flatCounters;
+
+/**
+ * Cold data of a flow in the flat table (written when the flow is created, read when it is exported and
+ * by the lookups of IPv6 flows).
+ */
+typedef struct flatCold{
+    struct timeval First;
+    u_int32_t srcaddr6[3], dstaddr6[3];
+}flatCold;
+
+/**
+ * Links of a doubly linked list of the timer wheel of the flat table.
+ */
+typedef struct flatLink{
+    u_int32_t prev, next;
+}flatLink;
+
+/**
+ * Open addressing hash table (Swiss table). The slots are divided in groups of FLAT_GROUP and each slot has a
+ * control byte, containing 7 bits of the hash of its flow. A lookup compares the control bytes of a whole
+ * group with the fingerprint of the flow and compares the keys only of the slots that match, probing the
+ * groups until it finds one with an empty slot.
+ * The flows are stored by columns: the keys, the counters, the Last timestamps (scanned by checkExpiration)
+ * and the cold data are in separate arrays, so a lookup only touches the control bytes and the key.
+ * The flows are expired by a timer wheel with a bucket for each second: each flow is in the bucket of
+ * its deadline (computed when the flow is inserted) and, when the bucket is reached, it is exported or,
+ * if it has been updated in the meantime, moved to the bucket of its new deadline. So the packets don't
+ * move the flows and each expiration costs O(1).
+ */
+class FlatHash: public FlowTable{
+private:
+    int8_t *ctrl;         ///<Control byte of each slot (FLAT_EMPTY, FLAT_DELETED or the fingerprint of its flow).
+    flatKey *keys;        ///<The keys of the flows.
+    flatCounters *counters; ///<The counters of the flows.
+    struct timeval *last; ///<The Last timestamps of the flows.
+    flatCold *cold;       ///<The cold data of the flows.
+    Arena *arena;         ///<The memory of the columns.
+    flatLink *links;      ///<Links of the flows (the first capacity) and of the buckets of the wheel (the sentinels).
+    time_t wheelTime;     ///<The next second of the wheel to check (0 if the wheel has not been started).
+    uint capacity,        ///<Number of slots (a power of two).
+        groupMask,        ///<Number of groups-1.
+        maxCapacity,      ///<The table doesn't grow over this number of slots.
+        usedSlots,        ///<Number of slots that are not empty (flows and deleted ones).
+        maxActiveFlows,   ///<Max number of active flows.
+        evictFlows,       ///<Number of flows evicted when the table has the max number of active flows.
+        activeFlows,      ///<Number of active flows.
+        wheelSize,        ///<Number of buckets of the wheel (a power of two).
+        idle,             ///<Max number of seconds of inactivity.
+        lifetime;         ///<Max number of life's seconds of a flow.
+
+    /**The table owns its arena, so it can't be copied.**/
+    FlatHash(const FlatHash&)=delete;
+    FlatHash& operator=(const FlatHash&)=delete;
+
+    /**
+     * Allocates the table.
+     * \param c Number of slots.
+     */
+    void allocate(uint c);
+
+    /**
+     * Releases the columns of the table.
+     */
+    void release();
+
+    /**
+     * Rebuilds the table removing the deleted slots (doubling it if it is at least half full).
+     */
+    void rehash();
+
+    /**
+     * Stores a new flow in a slot.
+     * \param i The slot.
+     * \param f The flow.
+     */
+    void store(uint i, const hashElement& f);
+
+    /**
+     * Rebuilds the record of a flow from its columns.
+     * \param k The key of the flow.
+     * \param c The counters of the flow.
+     * \param l The Last timestamp of the flow.
+     * \param d The cold data of the flow.
+     * \param f It will contain the flow.
+     */
+    static void load(const flatKey& k, const flatCounters& c, const struct timeval& l, const flatCold& d,
+                     hashElement& f);
+
+    /**
+     * Removes a flow from the table.
+     * \param i The slot of the flow.
+     */
+    void erase(uint i);
+
+    /**
+     * Frees the slot of a flow, without removing it from the wheel.
+     * \param i The slot of the flow.
+     */
+    void clearSlot(uint i);
+
+    /**
+     * Empties the buckets of the wheel.
+     */
+    void resetWheel();
+
+    /**
+     * Exports and removes the flows with the nearest deadlines (the least recently updated ones, if they are
+     * far from the end of their lifetime).
+     * \param n Number of flows to remove.
+     * \param l A pointer to the list where to add the removed flows.
+     */
+    void evict(uint n, flowQueue* l);
+
+    /**
+     * Removes a flow from its bucket of the wheel.
+     * \param i The slot of the flow.
+     */
+    inline void unlink(uint i){
+        links[links[i].prev].next=links[i].next;
+        links[links[i].next].prev=links[i].prev;
+    }
+
+    /**
+     * Inserts a flow in a bucket of the wheel. Deadlines already passed are put in the next bucket to check,
+     * deadlines beyond the wheel in the last bucket (the flow will be moved when the bucket is reached).
+     * \param i The slot of the flow.
+     * \param d The deadline of the flow.
+     */
+    inline void schedule(uint i, time_t d){
+        if(d<wheelTime) d=wheelTime;
+        else if(d-wheelTime>=wheelSize) d=wheelTime+wheelSize-1;
+        uint b=capacity+(d&(wheelSize-1));
+        links[i].prev=links[b].prev;
+        links[i].next=b;
+        links[links[b].prev].next=i;
+        links[b].prev=i;
+    }
+
+    /**
+     * Returns the first second in which the flow stored in a slot is expired (see isExpired): 0 if FIN
+     * or RST are arrived, otherwise the first of the idle and lifetime deadlines. The Last timestamp is read
+     * from its dense column.
+     * \param i The slot of the flow.
+     */
+    inline time_t deadline(uint i){
+        if((counters[i].tcp_flags&0x5)!=0x0) return 0;
+        return std::min((time_t)(last[i].tv_sec+idle),(time_t)(cold[i].First.tv_sec+lifetime))+1;
+    }
+
+    /**
+     * Returns the 7 bits of the hash of a flow stored in its control byte (not correlated with the
+     * bits that choose the worker and the group).
+     */
+    static inline int8_t fingerprint(uint32_t hash){
+        return (int8_t)((hash*0x9E3779B1u)>>25);
+    }
+
+    /**
+     * Returns a bitmask of the slots of a group whose control byte is v.
+     * \param g The control bytes of the group.
+     * \param v The control byte.
+     */
+    static inline uint match(const int8_t* g, int8_t v){
+#ifdef __SSE2__
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)g),_mm_set1_epi8(v)));
+#else
+        uint m=0;
+        for(uint i=0; i<FLAT_GROUP; i++)
+            m|=(uint)(g[i]==v)<<i;
+        return m;
+#endif
+    }
+
+    /**
+     * Returns a bitmask of the free (empty or deleted) slots of a group.
+     * \param g The control bytes of the group.
+     */
+    static inline uint matchFree(const int8_t* g){
+#ifdef __SSE2__
+        return _mm_movemask_epi8(_mm_load_si128((const __m128i*)g));
+#else
+        uint m=0;
+        for(uint i=0; i<FLAT_GROUP; i++)
+            m|=(uint)(g[i]<0)<<i;
+        return m;
+#endif
+    }
+
+    /**
+     * Checks if the flow stored in a slot has the same key of f.
+     * \param i The slot.
+     * \param f The flow.
+     */
+    inline bool keyEquals(uint i, const hashElement& f){
+        const flatKey& k=keys[i];
+        return k.srcaddr==f.srcaddr && k.dstaddr==f.dstaddr && k.srcport==f.srcport &&
+                k.dstport==f.dstport && k.prot==f.prot && k.tos==f.tos && k.ipVersion==f.ipVersion &&
+                ((k.vlanId^f.vlanId)&vlanKeyMask)==0 && k.tunnelId==f.tunnelId &&
+                (k.ipVersion==4 || (memcmp(cold[i].srcaddr6,f.srcaddr6,sizeof(f.srcaddr6))==0 &&
+                                    memcmp(cold[i].dstaddr6,f.dstaddr6,sizeof(f.dstaddr6))==0));
+    }
+
+    /**
+     * Finds the slot of a flow.
+     * \param f The flow.
+     * \param freeSlot It will contain the first free slot on the probe sequence of the flow.
+     * \return The slot of the flow or capacity if the flow is not in the table.
+     */
+    inline uint find(const hashElement& f, uint* freeSlot){
+        int8_t fp=fingerprint(f.hashId);
+        uint g=f.hashId&groupMask;
+        *freeSlot=capacity;
+        for(uint step=1; ; step++){
+            const int8_t* c=ctrl+g*FLAT_GROUP;
+            for(uint m=match(c,fp); m; m&=m-1){
+                uint i=g*FLAT_GROUP+__builtin_ctz(m);
+                if(keyEquals(i,f)) return i;
+            }
+            if(*freeSlot==capacity){
+                uint m=matchFree(c);
+                if(m) *freeSlot=g*FLAT_GROUP+__builtin_ctz(m);
+            }
+            /**The flow would have been stored in this group.**/
+            if(match(c,FLAT_EMPTY)) return capacity;
+            g=(g+step)&groupMask;
+        }
+    }
+public:
+    /**
+     * Constructor of the flat table.
+     * \param d Initial number of slots (rounded up to a power of two). The table grows up to the slots
+     *          needed for maxActiveFlows flows. If useHugePages is true they are allocated immediately.
+     * \param maxActiveFlows Maximum number of active flows.
+     * \param evictFlows Number of flows evicted (the ones with the nearest deadlines) when the table has
+     *                   maxActiveFlows flows.
+     * \param idle Max number of seconds of inactivity.
+     * \param lifeTime Max number of life's seconds of a flow.
+     */
+    FlatHash(uint d, uint maxActiveFlows, uint evictFlows, uint idle, uint lifetime);
+
+    /**
+     * Destructor of the flat table.
+     */
+    ~FlatHash();
+
+    void updateFlows(packetRecords* packets, flowQueue* l);
+
+    void checkExpiration(int n, flowQueue* l, time_t* now);
+
+    void flush(flowQueue *flowsToExport);
 
     uint getActiveFlows();
 };
 
+/**
+ * Creates a table of flows.
+ * \param type The type of the table ("chained" or "flat"). If it is NULL the table is "flat".
+ * \param d Number of rows (slots for the flat table) of the table.
+ * \param maxActiveFlows Maximum number of active flows.
+ * \param evictFlows Number of flows evicted when the table has maxActiveFlows flows.
+ * \param idle Max number of seconds of inactivity.
+ * \param lifeTime Max number of life's seconds of a flow.
+ * \return The table or NULL if the type is unknown.
+ */
+FlowTable* createFlowTable(const char* type, uint d, uint maxActiveFlows, uint evictFlows, uint idle, uint lifetime);
+
+/**
+ * Hashes three 64 bits words. It uses the CRC32C instruction when it is available (SSE4.2 or ARMv8 CRC),
+ * a multiply-xorshift mix otherwise. All the bits of the result are mixed, so both the high bits (used to
+ * choose the worker) and the low bits (used to choose the row of the table) can be used.
+ * \param a The first word.
+ * \param b The second word.
+ * \param c The third word.
+ * \return The hash.
+ */
+inline uint32_t hashWords(uint64_t a, uint64_t b, uint64_t c){
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    uint32_t h=_mm_crc32_u64(_mm_crc32_u64(_mm_crc32_u64(HASH_SEED,a),b),c);
+#elif defined(__ARM_FEATURE_CRC32)
+    uint32_t h=__crc32cd(__crc32cd(__crc32cd(HASH_SEED,a),b),c);
+#else
+    uint64_t x=(a*0x9E3779B97F4A7C15ULL)^(b*0xC2B2AE3D27D4EB4FULL)^(c*0x165667B19E3779F9ULL)^HASH_SEED;
+    x^=x>>29;
+    x*=0xBF58476D1CE4E5B9ULL;
+    uint32_t h=(uint32_t)(x^(x>>32));
+#endif
+    /**Final avalanche (fmix32 of MurmurHash3).**/
+    h^=h>>16;
+    h*=0x85ebca6b;
+    h^=h>>13;
+    h*=0xc2b2ae35;
+    h^=h>>16;
+    return h;
+}
 
 /**
- * Computes the hash function on a flow.
+ * Computes the hash function on a flow. If symmetricHash is true the two directions of the flow have
+ * the same hash.
  * \param f The flow.
- * \param mod Size of the hash table (Size(hashT1)+Size(hashT2)+....+Size(hashTn))
- * \return Hash(f)%Mod
+ * \return The hash of the flow.
+ */
+inline uint32_t hashFun(const hashElement& f){
+    uint64_t src=((uint64_t)(f.srcaddr^f.srcaddr6[0]^f.srcaddr6[1]^f.srcaddr6[2])<<16)|f.srcport,
+             dst=((uint64_t)(f.dstaddr^f.dstaddr6[0]^f.dstaddr6[1]^f.dstaddr6[2])<<16)|f.dstport;
+    if(symmetricHash && src>dst) std::swap(src,dst);
+    return hashWords(src,dst,f.prot|(f.tos<<8)|((uint64_t)(f.vlanId&vlanKeyMask)<<16)|((uint64_t)f.tunnelId<<32));
+}
+
+/**
+ * Chooses the partition (e.g. the worker) of a flow from the high bits of its hash, without divisions.
+ * \param hash The hash of the flow.
+ * \param n Number of partitions.
+ * \return The partition (between 0 and n-1).
  */
-inline uint hashFun(const hashElement& f,const uint mod){
-    return (f.dstaddr+f.srcaddr+f.prot+f.srcport+f.dstport+f.tos)%mod;
+inline uint selectPartition(uint32_t hash, uint n){
+    return ((uint64_t)hash*n)>>32;
 }
 
 
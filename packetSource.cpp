@@ -0,0 +1,427 @@
+/*
+ * packetSource.cpp
+ *
+ * \date 16/10/2026
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * Sources from which the readers capture the packets.
+ */
+
+#include "packetSource.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#endif
+
+/**
+ * Maximum number of packets copied by the sources in a single burst.
+ */
+#define SOURCE_MAX_BURST 1024
+
+/**
+ * Geometry of the TPACKET_V3 ring of an AF_PACKET source.
+ */
+#define AFPACKET_BLOCK_SIZE (1 << 22)
+#define AFPACKET_BLOCK_NR 64
+#define AFPACKET_FRAME_SIZE 2048
+#define AFPACKET_BLOCK_TIMEOUT 10 ///<Milliseconds after which the kernel hands out a block that is not full.
+
+#ifdef HAVE_PFRING
+PfringSource::PfringSource():ring(NULL),slots(new u_char[SOURCE_MAX_BURST*SOURCE_SNAPLEN]),parsing(false){;}
+
+PfringSource::~PfringSource(){
+    close();
+    delete[] slots;
+}
+
+int PfringSource::open(const char* device, uint promisc, uint id){
+#ifdef PF_RING_LONG_HEADER
+    /**PF_RING >= 5.0: the kernel module fills parsed_pkt only if the long header is requested.**/
+    ring=pfring_open(device, SOURCE_SNAPLEN, (promisc?PF_RING_PROMISC:0)|(parsing?PF_RING_LONG_HEADER:0));
+#else
+    ring=pfring_open(device, promisc, SOURCE_SNAPLEN);
+#endif
+    if(ring==NULL){
+        perror("pfring_open");
+        return -1;
+    }
+    if(pfring_set_cluster(ring, id+1, cluster_per_flow)!=0 ||
+       pfring_set_direction(ring, rx_only_direction)!=0 ||
+       pfring_enable_ring(ring)!=0){
+        fprintf(stderr,"Impossible to configure the PF_RING socket on %s.\n",device);
+        close();
+        return -1;
+    }
+    //pfring_set_poll_watermark(ring, 0);
+    return 0;
+}
+
+/**
+ * PF_RING only returns a pointer to the ring valid until the next pfring_recv, so the headers
+ * of the packets are copied in the slots.
+ */
+int PfringSource::recvBurst(packet* pkts, uint n){
+    struct pfring_pkthdr hdr;
+    u_char *slot=slots;
+    uint i;
+    n=std::min(n,(uint)SOURCE_MAX_BURST);
+    for(i=0; i<n; i++){
+        if(pfring_recv(ring, &slot, SOURCE_SNAPLEN, &hdr, 0)<=0) break;
+        pkts[i].data=slot;
+        pkts[i].hdr.ts=hdr.ts;
+        pkts[i].hdr.caplen=std::min(hdr.caplen,(uint32_t)SOURCE_SNAPLEN);
+        pkts[i].hdr.len=hdr.len;
+        if(parsing){
+            const pkt_parsing_info &p=hdr.extended_hdr.parsed_pkt;
+            packetMetadata &m=pkts[i].meta;
+            /**The kernel module stores addresses and ports in host byte order.**/
+#ifdef PF_RING_LONG_HEADER
+            m.valid=(p.ip_version==4);
+            m.srcaddr=htonl(p.ip_src.v4);
+            m.dstaddr=htonl(p.ip_dst.v4);
+            m.tos=p.ip_tos;
+#else
+            m.valid=(p.eth_type==0x0800);
+            m.srcaddr=htonl(p.ipv4_src);
+            m.dstaddr=htonl(p.ipv4_dst);
+            m.tos=p.ipv4_tos;
+#endif
+            m.prot=p.l3_proto;
+            m.srcport=htons(p.l4_src_port);
+            m.dstport=htons(p.l4_dst_port);
+            m.tcp_flags=(p.l3_proto==6)?p.tcp.flags:0;
+            m.vlanId=p.vlan_id&0x0fff;
+            m.networkOffset=p.offset.l3_offset;
+            m.timestampNs=hdr.extended_hdr.timestamp_ns;
+            if(m.timestampNs==0)
+                m.timestampNs=(uint64_t)hdr.ts.tv_sec*1000000000ULL+(uint64_t)hdr.ts.tv_usec*1000;
+        }
+        slot+=SOURCE_SNAPLEN;
+    }
+    return i;
+}
+
+void PfringSource::stats(uint64_t* recv, uint64_t* drop){
+    pfring_stat ps;
+    memset(&ps,0,sizeof(ps));
+    pfring_stats(ring, &ps);
+    *recv=ps.recv;
+    *drop=ps.drop;
+}
+
+void PfringSource::close(){
+    if(ring) pfring_close(ring);
+    ring=NULL;
+}
+
+int PfringSource::getDatalinkType(){
+    return 1;
+}
+
+bool PfringSource::enableParsing(){
+    parsing=true;
+    return true;
+}
+#endif
+
+#ifdef HAVE_PCAP
+PcapSource::PcapSource():p(NULL),slots(new u_char[SOURCE_MAX_BURST*SOURCE_SNAPLEN]),burst(NULL),received(0){;}
+
+PcapSource::~PcapSource(){
+    close();
+    delete[] slots;
+}
+
+int PcapSource::open(const char* device, uint promisc, uint id){
+    char errbuf[PCAP_ERRBUF_SIZE];
+    p=pcap_create(device, errbuf);
+    if(p==NULL){
+        fprintf(stderr,"pcap_create: %s\n",errbuf);
+        return -1;
+    }
+    pcap_set_snaplen(p, SOURCE_SNAPLEN);
+    pcap_set_promisc(p, promisc);
+    pcap_set_timeout(p, 200);
+    if(pcap_activate(p)<0 || pcap_setnonblock(p, 1, errbuf)<0){
+        fprintf(stderr,"Impossible to capture from %s: %s\n",device,pcap_geterr(p));
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+void PcapSource::callback(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes){
+    PcapSource *s=(PcapSource*) user;
+    packet *pkt=&(s->burst[s->received]);
+    u_char *slot=s->slots+s->received*SOURCE_SNAPLEN;
+    uint32_t caplen=std::min(h->caplen,(bpf_u_int32)SOURCE_SNAPLEN);
+    memcpy(slot,bytes,caplen);
+    pkt->data=slot;
+    pkt->hdr.ts=h->ts;
+    pkt->hdr.caplen=caplen;
+    pkt->hdr.len=h->len;
+    ++(s->received);
+}
+
+int PcapSource::recvBurst(packet* pkts, uint n){
+    burst=pkts;
+    received=0;
+    if(pcap_dispatch(p, std::min(n,(uint)SOURCE_MAX_BURST), callback, (u_char*) this)<0)
+        return received?(int)received:-1;
+    return received;
+}
+
+void PcapSource::stats(uint64_t* recv, uint64_t* drop){
+    struct pcap_stat ps;
+    memset(&ps,0,sizeof(ps));
+    pcap_stats(p, &ps);
+    *recv=ps.ps_recv;
+    *drop=ps.ps_drop;
+}
+
+void PcapSource::close(){
+    if(p) pcap_close(p);
+    p=NULL;
+}
+
+int PcapSource::getDatalinkType(){
+    return pcap_datalink(p);
+}
+#endif
+
+#ifdef __linux__
+AfpacketSource::AfpacketSource():fd(-1),ring(NULL),blockSize(AFPACKET_BLOCK_SIZE),blockNr(AFPACKET_BLOCK_NR),
+                                 current(0),left(0),toRelease(0),inUse(false),next(NULL),received(0),dropped(0){;}
+
+AfpacketSource::~AfpacketSource(){
+    close();
+}
+
+int AfpacketSource::open(const char* device, uint promisc, uint id){
+    /**The protocol is given at bind time, so no packet of other interfaces enters the ring.**/
+    if((fd=socket(AF_PACKET, SOCK_RAW, 0))<0){
+        perror("AF_PACKET socket");
+        return -1;
+    }
+    int version=TPACKET_V3;
+    if(setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))<0){
+        perror("TPACKET_V3");
+        close();
+        return -1;
+    }
+    tpacket_req3 req;
+    memset(&req,0,sizeof(req));
+    req.tp_block_size=blockSize;
+    req.tp_block_nr=blockNr;
+    req.tp_frame_size=AFPACKET_FRAME_SIZE;
+    req.tp_frame_nr=(blockSize*blockNr)/AFPACKET_FRAME_SIZE;
+    req.tp_retire_blk_tov=AFPACKET_BLOCK_TIMEOUT;
+    if(setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))<0){
+        perror("PACKET_RX_RING");
+        close();
+        return -1;
+    }
+    ring=(u_char*) mmap(NULL, (size_t)blockSize*blockNr, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_LOCKED|MAP_POPULATE, fd, 0);
+    if(ring==MAP_FAILED){
+        /**MAP_LOCKED fails if the ring exceeds RLIMIT_MEMLOCK.**/
+        ring=(u_char*) mmap(NULL, (size_t)blockSize*blockNr, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, 0);
+        if(ring==MAP_FAILED){
+            perror("Mapping AF_PACKET ring");
+            ring=NULL;
+            close();
+            return -1;
+        }
+    }
+    sockaddr_ll ll;
+    memset(&ll,0,sizeof(ll));
+    ll.sll_family=AF_PACKET;
+    ll.sll_protocol=htons(ETH_P_ALL);
+    ll.sll_ifindex=if_nametoindex(device);
+    if(ll.sll_ifindex==0 || bind(fd, (sockaddr*) &ll, sizeof(ll))<0){
+        perror("Binding AF_PACKET socket");
+        close();
+        return -1;
+    }
+    if(promisc){
+        packet_mreq mr;
+        memset(&mr,0,sizeof(mr));
+        mr.mr_ifindex=ll.sll_ifindex;
+        mr.mr_type=PACKET_MR_PROMISC;
+        if(setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr))<0)
+            perror("Promiscuous mode");
+    }
+    /**
+     * The readers of this probe reading from the same interface share the same group (a different
+     * probe on the same interface receives all the packets).
+     */
+    int fanout=((getpid()+ll.sll_ifindex)&0xffff)|((PACKET_FANOUT_HASH|PACKET_FANOUT_FLAG_DEFRAG)<<16);
+    if(setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout))<0){
+        perror("PACKET_FANOUT");
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * The packets are returned without copying them. A block is given back to the kernel at the call
+ * following the one that returned its last packet.
+ */
+int AfpacketSource::recvBurst(packet* pkts, uint n){
+    uint i=0;
+    if(inUse && left==0){
+        ++toRelease;
+        current=(current+1)%blockNr;
+        inUse=false;
+    }
+    for(; toRelease; --toRelease)
+        __atomic_store_n(&(block((current+blockNr-toRelease)%blockNr)->hdr.bh1.block_status), TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    while(i<n){
+        if(!inUse){
+            tpacket_block_desc *b=block(current);
+            if(!(__atomic_load_n(&(b->hdr.bh1.block_status), __ATOMIC_ACQUIRE)&TP_STATUS_USER)) break;
+            inUse=true;
+            left=b->hdr.bh1.num_pkts;
+            next=(tpacket3_hdr*) ((u_char*)b+b->hdr.bh1.offset_to_first_pkt);
+        }
+        for(; left && i<n; --left, ++i){
+            pkts[i].data=(u_char*)next+next->tp_mac;
+            pkts[i].hdr.ts.tv_sec=next->tp_sec;
+            pkts[i].hdr.ts.tv_usec=next->tp_nsec/1000;
+            pkts[i].hdr.caplen=next->tp_snaplen;
+            pkts[i].hdr.len=next->tp_len;
+            /**The NIC may strip the 802.1Q tag, the kernel gives it in the header.**/
+            pkts[i].vlanId=(next->tp_status&TP_STATUS_VLAN_VALID)?(next->hv1.tp_vlan_tci&0x0fff):0;
+            next=(tpacket3_hdr*) ((u_char*)next+next->tp_next_offset);
+        }
+        if(left==0){
+            ++toRelease;
+            current=(current+1)%blockNr;
+            inUse=false;
+        }
+    }
+    received+=i;
+    return i;
+}
+
+void AfpacketSource::stats(uint64_t* recv, uint64_t* drop){
+    tpacket_stats_v3 st;
+    socklen_t len=sizeof(st);
+    /**The kernel resets its counters at each read.**/
+    if(fd>=0 && getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &st, &len)==0)
+        dropped+=st.tp_drops;
+    *recv=received;
+    *drop=dropped;
+}
+
+void AfpacketSource::close(){
+    if(ring) munmap(ring, (size_t)blockSize*blockNr);
+    if(fd>=0) ::close(fd);
+    ring=NULL;
+    fd=-1;
+}
+
+int AfpacketSource::getDatalinkType(){
+    return 1;
+}
+#endif
+
+FileSource::FileSource():file(NULL),read(0){;}
+
+FileSource::~FileSource(){
+    close();
+}
+
+int FileSource::open(const char* device, uint promisc, uint id){
+    file=new PcapFile(device);
+    return 0;
+}
+
+/**
+ * The packets are returned without copying them, they remain valid until the file is closed.
+ */
+int FileSource::recvBurst(packet* pkts, uint n){
+    uint i;
+    for(i=0; i<n; i++)
+        if(!file->next(&(pkts[i].data),&(pkts[i].hdr))) break;
+    read+=i;
+    return (i==0 && n!=0)?-1:(int)i;
+}
+
+void FileSource::stats(uint64_t* recv, uint64_t* drop){
+    *recv=read;
+    *drop=0;
+}
+
+void FileSource::close(){
+    if(file) delete file;
+    file=NULL;
+}
+
+int FileSource::getDatalinkType(){
+    return file->getDatalinkType();
+}
+
+bool FileSource::isOffline(){
+    return true;
+}
+
+/**
+ * Creates a source of packets.
+ * \param type The type of the source ("pfring", "pcap", "afpacket" or "file"). If it is NULL the
+ *             source is a file if device is a regular file, PF_RING (or AF_PACKET if ffProbe has been
+ *             compiled without PF_RING) otherwise.
+ * \param device Name of the device (or of the capture file).
+ * \return The source or NULL if the type is unknown (or not available).
+ */
+PacketSource* createPacketSource(const char* type, const char* device){
+    if(type==NULL){
+#ifdef HAVE_PFRING
+        type=PcapFile::isCaptureFile(device)?"file":"pfring";
+#else
+        type=PcapFile::isCaptureFile(device)?"file":"afpacket";
+#endif
+    }
+#ifdef HAVE_PFRING
+    if(strcmp(type,"pfring")==0)
+        return new PfringSource();
+#endif
+#ifdef HAVE_PCAP
+    if(strcmp(type,"pcap")==0)
+        return new PcapSource();
+#endif
+#ifdef __linux__
+    if(strcmp(type,"afpacket")==0)
+        return new AfpacketSource();
+#endif
+    if(strcmp(type,"file")==0)
+        return new FileSource();
+    return NULL;
+}
@@ -0,0 +1,241 @@
+/*
+ * packetSource.hpp
+ *
+ * \date 16/10/2026
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * Sources from which the readers capture the packets.
+ */
+
+#ifndef PACKETSOURCE_HPP_
+#define PACKETSOURCE_HPP_
+#include <stdint.h>
+#include <sys/types.h>
+#ifdef HAVE_PCAP
+#include <pcap.h>
+#endif
+#ifdef HAVE_PFRING
+#include <pfring.h>
+#endif
+#ifdef __linux__
+#include <linux/if_packet.h>
+#endif
+#include "pcapFile.hpp"
+
+/**
+ * Number of bytes kept for each packet by the sources that can't return a pointer
+ * to their own buffers (they copy the packets).
+ */
+#define SOURCE_SNAPLEN 256
+
+/**
+ * The fields of a packet already parsed by the source (e.g. by the PF_RING kernel module).
+ * Addresses and ports are in network byte order, as in the packet.
+ */
+struct packetMetadata {
+    uint64_t timestampNs; ///<Capture time of the packet (nanoseconds).
+    uint32_t srcaddr;     ///<Source IPv4 address.
+    uint32_t dstaddr;     ///<Destination IPv4 address.
+    uint16_t srcport;     ///<TCP/UDP source port.
+    uint16_t dstport;     ///<TCP/UDP destination port.
+    uint8_t prot;         ///<IP protocol.
+    uint8_t tos;          ///<IP Type-of-Service.
+    uint8_t tcp_flags;    ///<TCP flags.
+    uint16_t vlanId;      ///<VLAN ID (0 if the packet is untagged).
+    uint16_t networkOffset; ///<Offset of the IP header from the start of the packet.
+    bool valid;           ///<False if the source didn't parse the packet (it must be parsed in software).
+};
+
+/**
+ * A packet returned by a source.
+ */
+struct packet {
+    const u_char *data; ///<The packet.
+    packetHeader hdr;   ///<The header of the packet.
+    packetMetadata meta; ///<The parsed fields of the packet (only if enableParsing returned true).
+    uint16_t vlanId;    ///<VLAN ID of the 802.1Q tag removed from the packet by the NIC (0 if none).
+};
+
+/**
+ * A source of packets. The packets are returned in bursts, so the cost of a call is paid once
+ * for many packets.
+ */
+class PacketSource{
+public:
+    virtual ~PacketSource(){;}
+
+    /**
+     * Opens the source.
+     * \param device Name of the device (or of the capture file).
+     * \param promisc 1 if the interface must be set in promiscous mode, 0 otherwise.
+     * \param id The identifier of the reader that will use the source.
+     * \return 0 on success, -1 on error.
+     */
+    virtual int open(const char* device, uint promisc, uint id)=0;
+
+    /**
+     * Receives the packets that are available, without waiting for them. The packets remain valid
+     * until the next call of recvBurst (or close).
+     * \param pkts The array where the packets will be stored.
+     * \param n Maximum number of packets to receive.
+     * \return The number of packets received or -1 if the source is exhausted.
+     */
+    virtual int recvBurst(packet* pkts, uint n)=0;
+
+    /**
+     * Returns the statistics of the source.
+     * \param recv It will contain the number of packets received.
+     * \param drop It will contain the number of packets dropped.
+     */
+    virtual void stats(uint64_t* recv, uint64_t* drop)=0;
+
+    /**
+     * Closes the source.
+     */
+    virtual void close()=0;
+
+    /**
+     * Returns the datalink type of the packets (e.g. 1 for Ethernet).
+     */
+    virtual int getDatalinkType()=0;
+
+    /**
+     * Returns true if the packets are not captured live (and so the time is given by the packets).
+     */
+    virtual bool isOffline(){return false;}
+
+    /**
+     * Asks the source to parse the packets and to fill their metadata. It must be called before open.
+     * \return False if the source is not able to parse the packets.
+     */
+    virtual bool enableParsing(){return false;}
+};
+
+#ifdef HAVE_PFRING
+/**
+ * Packets captured with PF_RING.
+ */
+class PfringSource: public PacketSource{
+private:
+    pfring *ring;
+    u_char *slots; ///<Copies of the packets of the last burst.
+    bool parsing; ///<True if the metadata parsed by the PF_RING kernel module must be returned.
+public:
+    PfringSource();
+    ~PfringSource();
+    int open(const char* device, uint promisc, uint id);
+    int recvBurst(packet* pkts, uint n);
+    void stats(uint64_t* recv, uint64_t* drop);
+    void close();
+    int getDatalinkType();
+    bool enableParsing();
+};
+#endif
+
+#ifdef HAVE_PCAP
+/**
+ * Packets captured with libpcap.
+ */
+class PcapSource: public PacketSource{
+private:
+    pcap_t *p;
+    u_char *slots; ///<Copies of the packets of the last burst.
+    packet *burst; ///<The burst being filled by pcap_dispatch.
+    uint received; ///<Number of packets of the burst being filled.
+
+    static void callback(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes);
+public:
+    PcapSource();
+    ~PcapSource();
+    int open(const char* device, uint promisc, uint id);
+    int recvBurst(packet* pkts, uint n);
+    void stats(uint64_t* recv, uint64_t* drop);
+    void close();
+    int getDatalinkType();
+};
+#endif
+
+#ifdef __linux__
+/**
+ * Packets captured with an AF_PACKET socket and a TPACKET_V3 ring mapped in memory. The kernel fills
+ * blocks of packets and the reader walks a whole block without copying the packets. All the readers
+ * of a probe that open the same interface join the same PACKET_FANOUT_HASH group, so they share its
+ * traffic (e.g. -r 2 -i eth0_eth0).
+ */
+class AfpacketSource: public PacketSource{
+private:
+    int fd; ///<The socket.
+    u_char *ring; ///<The ring shared with the kernel.
+    uint blockSize, ///<Size of a block of the ring.
+         blockNr, ///<Number of blocks of the ring.
+         current, ///<The block containing the next packet.
+         left, ///<Packets of the current block still to read.
+         toRelease; ///<Blocks read in the last burst, to give back to the kernel.
+    bool inUse; ///<True if the current block belongs to the reader.
+    tpacket3_hdr *next; ///<The next packet of the current block.
+    uint64_t received, ///<Packets received.
+             dropped; ///<Packets dropped.
+
+    inline tpacket_block_desc* block(uint i){
+        return (tpacket_block_desc*) (ring+(size_t)i*blockSize);
+    }
+public:
+    AfpacketSource();
+    ~AfpacketSource();
+    int open(const char* device, uint promisc, uint id);
+    int recvBurst(packet* pkts, uint n);
+    void stats(uint64_t* recv, uint64_t* drop);
+    void close();
+    int getDatalinkType();
+};
+#endif
+
+/**
+ * Packets read from a .pcap or .pcapng file.
+ */
+class FileSource: public PacketSource{
+private:
+    PcapFile *file;
+    uint64_t read; ///<Number of packets read.
+public:
+    FileSource();
+    ~FileSource();
+    int open(const char* device, uint promisc, uint id);
+    int recvBurst(packet* pkts, uint n);
+    void stats(uint64_t* recv, uint64_t* drop);
+    void close();
+    int getDatalinkType();
+    bool isOffline();
+};
+
+/**
+ * Creates a source of packets.
+ * \param type The type of the source ("pfring", "pcap", "afpacket" or "file"). If it is NULL the
+ *             source is a file if device is a regular file, PF_RING (or AF_PACKET if ffProbe has been
+ *             compiled without PF_RING) otherwise.
+ * \param device Name of the device (or of the capture file).
+ * \return The source or NULL if the type is unknown (or not available).
+ */
+PacketSource* createPacketSource(const char* type, const char* device);
+
+#endif /* PACKETSOURCE_HPP_ */
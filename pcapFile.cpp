@@ -0,0 +1,250 @@
+/*
+ * pcapFile.cpp
+ *
+ * \date 16/10/2026
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * Reader of .pcap and .pcapng capture files. The file is mapped in memory and
+ * the packets are returned without copying them.
+ */
+
+#include "pcapFile.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PCAP_MAGIC          0xa1b2c3d4
+#define PCAP_MAGIC_NSEC     0xa1b23c4d
+#define PCAPNG_SHB          0x0A0D0D0A
+#define PCAPNG_IDB          0x00000001
+#define PCAPNG_PB           0x00000002
+#define PCAPNG_SPB          0x00000003
+#define PCAPNG_EPB          0x00000006
+#define PCAPNG_BYTE_ORDER   0x1A2B3C4D
+#define PCAPNG_IF_TSRESOL   9
+
+/**
+ * Constructor of the capture file.
+ * \param path The path of the .pcap or .pcapng file.
+ */
+PcapFile::PcapFile(const char* path):ng(false),swapped(false),nsec(false),datalinkType(-1),snaplen(0),numInterfaces(0){
+    struct stat st;
+    if((fd=open(path,O_RDONLY))<0 || fstat(fd,&st)<0){
+        perror("Opening capture file");
+        exit(-1);
+    }
+    size=st.st_size;
+    if(size<24){
+        fprintf(stderr,"%s is not a .pcap or .pcapng file.\n",path);
+        exit(-1);
+    }
+    data=(const u_char*) mmap(NULL,size,PROT_READ,MAP_PRIVATE|MAP_POPULATE,fd,0);
+    if(data==MAP_FAILED){
+        perror("Mapping capture file");
+        exit(-1);
+    }
+    madvise((void*)data,size,MADV_SEQUENTIAL);
+    end=data+size;
+    uint32_t magic;
+    memcpy(&magic,data,sizeof(magic));
+    if(magic==PCAPNG_SHB){
+        ng=true;
+        pos=data;
+        /**Reads the blocks preceding the first packet to know the datalink type.**/
+        const u_char *p;
+        packetHeader hdr;
+        nextNg(&p,&hdr);
+        pos=data;
+    }else{
+        if(magic==__builtin_bswap32(PCAP_MAGIC) || magic==__builtin_bswap32(PCAP_MAGIC_NSEC)){
+            swapped=true;
+            magic=__builtin_bswap32(magic);
+        }
+        if(magic!=PCAP_MAGIC && magic!=PCAP_MAGIC_NSEC){
+            fprintf(stderr,"%s is not a .pcap or .pcapng file.\n",path);
+            exit(-1);
+        }
+        nsec=(magic==PCAP_MAGIC_NSEC);
+        snaplen=get32(data+16);
+        datalinkType=get32(data+20);
+        pos=data+24;
+    }
+    if(datalinkType==-1){
+        fprintf(stderr,"%s doesn't describe any interface.\n",path);
+        exit(-1);
+    }
+}
+
+/**
+ * Destructor of the capture file.
+ */
+PcapFile::~PcapFile(){
+    munmap((void*)data,size);
+    close(fd);
+}
+
+/**
+ * Returns the datalink type of the packets contained in the file.
+ * \return The datalink type (e.g. 1 for Ethernet).
+ */
+int PcapFile::getDatalinkType(){
+    return datalinkType;
+}
+
+/**
+ * Parses a .pcapng Section Header Block.
+ * \param block The block.
+ * \return False if the block is not valid.
+ */
+bool PcapFile::parseSectionHeader(const u_char* block){
+    uint32_t order;
+    memcpy(&order,block+8,sizeof(order));
+    if(order==PCAPNG_BYTE_ORDER) swapped=false;
+    else if(order==__builtin_bswap32(PCAPNG_BYTE_ORDER)) swapped=true;
+    else return false;
+    /**A new section starts a new set of interfaces.**/
+    numInterfaces=0;
+    return true;
+}
+
+/**
+ * Parses a .pcapng Interface Description Block.
+ * \param block The block.
+ * \param blockLen The length of the block.
+ */
+void PcapFile::parseInterface(const u_char* block, uint32_t blockLen){
+    if(numInterfaces==PCAPNG_MAX_INTERFACES) return;
+    int linkType=get16(block+8);
+    uint64_t units=1000000;
+    /**Options start after the link type, the reserved field and the snapshot length.**/
+    const u_char *opt=block+16, *optEnd=block+blockLen-4;
+    while(optEnd-opt>=4){
+        uint16_t code=get16(opt), len=get16(opt+2);
+        if(code==0 || optEnd-opt-4<len) break;
+        if(code==PCAPNG_IF_TSRESOL && len>=1){
+            uint8_t res=opt[4];
+            /**The units per second must fit in 64 bits, otherwise the packets of the interface are skipped.**/
+            if((res&0x80)?(res&0x7f)>63:res>19){
+                linkType=-1;
+                break;
+            }
+            units=1;
+            if(res&0x80)
+                units<<=(res&0x7f);
+            else
+                for(uint i=0; i<res; i++) units*=10;
+        }
+        opt+=4+((len+3)&~3);
+    }
+    if(datalinkType==-1 && linkType!=-1){
+        datalinkType=linkType;
+        snaplen=get32(block+12);
+    }
+    tsUnits[numInterfaces]=units;
+    linkTypes[numInterfaces]=linkType;
+    ++numInterfaces;
+}
+
+/**
+ * Reads the next packet of a .pcapng file.
+ */
+int PcapFile::nextNg(const u_char** pkt, packetHeader* hdr){
+    while(end-pos>=12){
+        uint32_t type, blockLen;
+        memcpy(&type,pos,sizeof(type));
+        if(type==PCAPNG_SHB){
+            if(!parseSectionHeader(pos)) return 0;
+        }else if(swapped){
+            type=__builtin_bswap32(type);
+        }
+        blockLen=get32(pos+4);
+        if(blockLen<12 || (size_t)(end-pos)<blockLen) return 0;
+        const u_char *block=pos;
+        pos+=blockLen;
+        uint32_t ifId=0, caplen, len;
+        uint64_t ts=0;
+        switch(type){
+            case PCAPNG_IDB:
+                parseInterface(block,blockLen);
+                continue;
+            case PCAPNG_EPB:
+                if(blockLen<32) continue;
+                ifId=get32(block+8);
+                ts=((uint64_t)get32(block+12)<<32)|get32(block+16);
+                caplen=get32(block+20);
+                len=get32(block+24);
+                *pkt=block+28;
+                break;
+            case PCAPNG_PB:
+                if(blockLen<32) continue;
+                ifId=get16(block+8);
+                ts=((uint64_t)get32(block+12)<<32)|get32(block+16);
+                caplen=get32(block+20);
+                len=get32(block+24);
+                *pkt=block+28;
+                break;
+            case PCAPNG_SPB:
+                if(blockLen<16) continue;
+                len=get32(block+8);
+                caplen=std::min(len,blockLen-16);
+                if(snaplen!=0 && caplen>snaplen) caplen=snaplen;
+                *pkt=block+12;
+                break;
+            default:
+                continue;
+        }
+        /**Skips truncated blocks and packets of interfaces with a different datalink.**/
+        if(ifId>=numInterfaces || linkTypes[ifId]!=datalinkType ||
+           (size_t)(block+blockLen-*pkt)<caplen)
+            continue;
+        uint64_t units=tsUnits[ifId];
+        if(units==1000000){
+            hdr->ts.tv_sec=ts/1000000;
+            hdr->ts.tv_usec=ts%1000000;
+        }else{
+            hdr->ts.tv_sec=ts/units;
+            /**The fraction is scaled down when finer than microseconds, so it can't overflow.**/
+            if(units>1000000)
+                hdr->ts.tv_usec=(ts%units)/(units/1000000);
+            else
+                hdr->ts.tv_usec=((ts%units)*1000000)/units;
+        }
+        hdr->caplen=caplen;
+        hdr->len=len;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Returns true if path is a regular file (and so it must be read as a capture file).
+ * \param path The path to check.
+ */
+bool PcapFile::isCaptureFile(const char* path){
+    struct stat st;
+    return stat(path,&st)==0 && S_ISREG(st.st_mode);
+}
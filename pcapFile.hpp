@@ -0,0 +1,144 @@
+/*
+ * pcapFile.hpp
+ *
+ * \date 16/10/2026
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * Reader of .pcap and .pcapng capture files. The file is mapped in memory and
+ * the packets are returned without copying them.
+ */
+
+#ifndef PCAPFILE_HPP_
+#define PCAPFILE_HPP_
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define PCAPNG_MAX_INTERFACES 64
+
+/**
+ * Header of a packet read from a capture file.
+ */
+struct packetHeader {
+    timeval ts;       ///<Capture time of the packet.
+    uint32_t caplen;  ///<Number of bytes of the packet stored in the file.
+    uint32_t len;     ///<Length of the packet on the wire.
+};
+
+/**
+ * A .pcap or .pcapng file mapped in memory.
+ */
+class PcapFile{
+private:
+    int fd; ///<File descriptor of the capture file.
+    const u_char *data, ///<Content of the file.
+                 *pos, ///<Next byte to read.
+                 *end; ///<First byte after the end of the file.
+    size_t size; ///<Size of the file.
+    bool ng, ///<True if the file is a .pcapng file.
+         swapped, ///<True if the file has been written with a different byte order.
+         nsec; ///<True if the timestamps of a .pcap file are in nanoseconds.
+    int datalinkType; ///<Datalink type of the packets.
+    uint32_t snaplen; ///<Snapshot length of the first interface.
+    uint numInterfaces; ///<Number of interfaces described in the current section (.pcapng only).
+    uint64_t tsUnits[PCAPNG_MAX_INTERFACES]; ///<Timestamp units per second of each interface (.pcapng only).
+    int linkTypes[PCAPNG_MAX_INTERFACES]; ///<Datalink type of each interface (.pcapng only, -1 if its packets are skipped).
+
+    inline uint16_t get16(const u_char* p) const{
+        uint16_t v;
+        memcpy(&v,p,sizeof(v));
+        return swapped?__builtin_bswap16(v):v;
+    }
+
+    inline uint32_t get32(const u_char* p) const{
+        uint32_t v;
+        memcpy(&v,p,sizeof(v));
+        return swapped?__builtin_bswap32(v):v;
+    }
+
+    /**
+     * Parses a .pcapng Section Header Block.
+     * \param block The block.
+     * \return False if the block is not valid.
+     */
+    bool parseSectionHeader(const u_char* block);
+
+    /**
+     * Parses a .pcapng Interface Description Block.
+     * \param block The block.
+     * \param blockLen The length of the block.
+     */
+    void parseInterface(const u_char* block, uint32_t blockLen);
+
+    /**
+     * Reads the next packet of a .pcapng file.
+     */
+    int nextNg(const u_char** pkt, packetHeader* hdr);
+public:
+    /**
+     * Constructor of the capture file.
+     * \param path The path of the .pcap or .pcapng file.
+     */
+    PcapFile(const char* path);
+
+    /**
+     * Destructor of the capture file.
+     */
+    ~PcapFile();
+
+    /**
+     * Returns the datalink type of the packets contained in the file.
+     * \return The datalink type (e.g. 1 for Ethernet).
+     */
+    int getDatalinkType();
+
+    /**
+     * Reads the next packet. The returned pointer refers to the mapped file and remains
+     * valid until the file is destroyed.
+     * \param pkt It will point to the packet.
+     * \param hdr It will be filled with the header of the packet.
+     * \return 1 if a packet has been read, 0 if the end of the file is arrived.
+     */
+    inline int next(const u_char** pkt, packetHeader* hdr){
+        if(ng) return nextNg(pkt,hdr);
+        if(end-pos<16) return 0;
+        uint32_t caplen=get32(pos+8);
+        if((size_t)(end-pos-16)<caplen) return 0;
+        hdr->ts.tv_sec=get32(pos);
+        hdr->ts.tv_usec=nsec?get32(pos+4)/1000:get32(pos+4);
+        hdr->caplen=caplen;
+        hdr->len=get32(pos+12);
+        *pkt=pos+16;
+        pos+=16+caplen;
+        return 1;
+    }
+
+    /**
+     * Returns true if path is a regular file (and so it must be read as a capture file).
+     * \param path The path to check.
+     */
+    static bool isCaptureFile(const char* path);
+};
+
+#endif /* PCAPFILE_HPP_ */
@@ -1,123 +1,229 @@
-/*
- * task.cpp
- *
- * \date 14/mag/2010
- * \author Daniele De Sensi (d.desensi.software@gmail.com)
- * =========================================================================
- *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
- *
- *  This file is part of ffProbe.
- *
- *  ffProbe is free software: you can redistribute it and/or
- *  modify it under the terms of the Lesser GNU General Public
- *  License as published by the Free Software Foundation, either
- *  version 3 of the License, or (at your option) any later version.
-
- *  ffProbe is distributed in the hope that it will be useful,
- *  but WITHOUT ANY WARRANTY; without even the implied warranty of
- *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *  Lesser GNU General Public License for more details.
- *
- *  You should have received a copy of the Lesser GNU General Public
- *  License along with ffProbe.
- *  If not, see <http://www.gnu.org/licenses/>.
- *
- * =========================================================================
- *
- * This file contains the definition of the task passed by the stages of the pipeline.
- */
-
- #include "task.hpp"
-
-
- /**
-  * Constructor of the task.
-  * \param numWorkers Number of workers of the pipeline.
-  */
- Task::Task(uint numWorkers):numWorkers(numWorkers),eof(false){
-     flowsToAdd=new ff::squeue<hashElement>*[numWorkers];
-     for(uint i=0; i<numWorkers; i++)
-         flowsToAdd[i]=new ff::squeue<hashElement>;
-     flowsToExport=new ff::squeue<hashElement>;
- }
-
- /**
-  * Denstructor of the task.
-  */
- Task::~Task(){
-     if(flowsToExport!=NULL) delete flowsToExport;
-     if(flowsToAdd!=NULL){
-         for(uint i=0; i<numWorkers; i++)
-             delete flowsToAdd[i];
-         delete[] flowsToAdd;
-     }
- }
-
-/**
- * Sets the timestamp of the task.
- * \param t The timestamp.
- */
-void Task::setTimestamp(time_t t){
-    timestamp=t;
-}
-
-/**
- * Returns the timestamp of the task.
- * \return The timestamp of the task.
- */
-time_t Task::getTimestamp(){
-    return timestamp;
-}
-
-/**
- * Adds an hashElement to the list of flows to export.
- * \param h The hashElement.
- */
-void Task::addFlowToExport(hashElement& h){
-    flowsToExport->push_back(h);
-}
-
-/**
- * Returns a pointer to the list of flows to export.
- * \return A pointer to the list of flows to export.
- */
-ff::squeue<hashElement>* Task::getFlowsToExport(){
-    return flowsToExport;
-}
-
-/**
- * Returns a pointer to the list of the flows to add.
- * \return A pointer to the list of the flows to add.
- */
-ff::squeue<hashElement>* Task::getFlowsToAdd(const int i){
-    return flowsToAdd[i];
-}
-
-/**
- * Adds the hashElement h for the i-th worker.
- * \param h The hashElement to add.
- * \param i The worker that have to add the flow.
- */
-void Task::setFlowToAdd(hashElement& h, const int i){
-    flowsToAdd[i]->push_back(h);
-}
-
-/**Sets EOF. **/
-void Task::setEof(){eof=true;}
-
-/**Resets EOF.**/
-void Task::resetEof(){eof=false;}
-
-/**
- * Returns true if EOF of a .pcap file is arrived.
- * \return True if EOF is arrived, otherwise returns false.
- */
-bool Task::isEof(){return eof;}
-
-/**
- * Returns the number of workers.
- * \return The number of workers.
- */
-int Task::getNumWorkers(){
-    return numWorkers;
-}
+/*
+ * task.cpp
+ *
+ * \date 14/mag/2010
+ * \author Daniele De Sensi (d.desensi.software@gmail.com)
+ * =========================================================================
+ *  Copyright (C) 2010-2014, Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ *  This file is part of ffProbe.
+ *
+ *  ffProbe is free software: you can redistribute it and/or
+ *  modify it under the terms of the Lesser GNU General Public
+ *  License as published by the Free Software Foundation, either
+ *  version 3 of the License, or (at your option) any later version.
+
+ *  ffProbe is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  Lesser GNU General Public License for more details.
+ *
+ *  You should have received a copy of the Lesser GNU General Public
+ *  License along with ffProbe.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * =========================================================================
+ *
+ * This file contains the definition of the task passed by the stages of the pipeline.
+ */
+
+ #include "task.hpp"
+
+
+ /**
+  * Constructor of the task.
+  * \param numWorkers Number of workers of the pipeline.
+  * \param rawSlices True if the packets are parsed by the workers instead of by the reader.
+  */
+ Task::Task(uint numWorkers, bool rawSlices):numWorkers(numWorkers),packetsToParse(NULL),numPacketsToParse(NULL),capacities(NULL),eof(false),
+                                             pool(NULL){
+     flowsToAdd=new packetRecords*[numWorkers];
+     for(uint i=0; i<numWorkers; i++)
+         flowsToAdd[i]=new packetRecords;
+     flowsToExport=new flowQueue;
+     if(rawSlices){
+         packetsToParse=new rawPacket*[numWorkers];
+         numPacketsToParse=new uint[numWorkers];
+         capacities=new uint[numWorkers];
+         for(uint i=0; i<numWorkers; i++){
+             capacities[i]=TASK_RAW_CAPACITY;
+             numPacketsToParse[i]=0;
+             packetsToParse[i]=(rawPacket*)malloc(capacities[i]*sizeof(rawPacket));
+             if(packetsToParse[i]==NULL){
+                 fprintf(stderr, "Impossible to allocate the packets to parse.\n");
+                 exit(-1);
+             }
+         }
+     }
+ }
+
+ /**
+  * Denstructor of the task.
+  */
+ Task::~Task(){
+     if(flowsToExport!=NULL) delete flowsToExport;
+     if(flowsToAdd!=NULL){
+         for(uint i=0; i<numWorkers; i++)
+             delete flowsToAdd[i];
+         delete[] flowsToAdd;
+     }
+     if(packetsToParse!=NULL){
+         for(uint i=0; i<numWorkers; i++)
+             free(packetsToParse[i]);
+         delete[] packetsToParse;
+         delete[] numPacketsToParse;
+         delete[] capacities;
+     }
+ }
+
+/**
+ * Empties the task, so that it can be reused.
+ */
+void Task::reset(){
+    for(uint i=0; i<numWorkers; i++)
+        flowsToAdd[i]->clear();
+    flowsToExport->clear();
+    if(packetsToParse!=NULL)
+        memset(numPacketsToParse,0,numWorkers*sizeof(uint));
+    eof=false;
+}
+
+/**
+ * Called when the flows of the task have been exported: returns the task to its pool or deletes it.
+ */
+void Task::release(){
+    if(pool!=NULL)
+        pool->put(this);
+    else
+        delete this;
+}
+
+/**
+ * Sets the timestamp of the task.
+ * \param t The timestamp.
+ */
+void Task::setTimestamp(time_t t){
+    timestamp=t;
+}
+
+/**
+ * Returns the timestamp of the task.
+ * \return The timestamp of the task.
+ */
+time_t Task::getTimestamp(){
+    return timestamp;
+}
+
+/**
+ * Adds an hashElement to the list of flows to export.
+ * \param h The hashElement.
+ */
+void Task::addFlowToExport(hashElement& h){
+    flowsToExport->push_back(h);
+}
+
+/**
+ * Returns a pointer to the list of flows to export.
+ * \return A pointer to the list of flows to export.
+ */
+flowQueue* Task::getFlowsToExport(){
+    return flowsToExport;
+}
+
+/**
+ * Returns a pointer to the packets of the i-th worker.
+ * \return A pointer to the packets of the i-th worker.
+ */
+packetRecords* Task::getFlowsToAdd(const int i){
+    return flowsToAdd[i];
+}
+
+/**
+ * Adds the packet whose flow is h for the i-th worker.
+ * \param h The flow of the packet (First is the capture time and dOctets the length).
+ * \param i The worker that have to add the flow.
+ */
+void Task::setFlowToAdd(hashElement& h, const int i){
+    flowsToAdd[i]->push_back(h);
+}
+
+/**
+ * Returns the packets that must be parsed by the i-th worker.
+ * \param i The worker.
+ * \param n It will contain the number of packets.
+ * \return The packets (NULL if the reader parses the packets).
+ */
+rawPacket* Task::getPacketsToParse(const int i, uint* n){
+    if(packetsToParse==NULL){
+        *n=0;
+        return NULL;
+    }
+    *n=numPacketsToParse[i];
+    return packetsToParse[i];
+}
+
+/**Sets EOF. **/
+void Task::setEof(){eof=true;}
+
+/**Resets EOF.**/
+void Task::resetEof(){eof=false;}
+
+/**
+ * Returns true if EOF of a .pcap file is arrived.
+ * \return True if EOF is arrived, otherwise returns false.
+ */
+bool Task::isEof(){return eof;}
+
+/**
+ * Returns the number of workers.
+ * \return The number of workers.
+ */
+int Task::getNumWorkers(){
+    return numWorkers;
+}
+
+/**
+ * Constructor of the pool.
+ * \param numWorkers Number of workers of the pipeline.
+ * \param rawSlices True if the packets are parsed by the workers instead of by the reader.
+ */
+TaskPool::TaskPool(uint numWorkers, bool rawSlices):numWorkers(numWorkers),rawSlices(rawSlices),returned(TASK_POOL_SIZE){
+    returned.init();
+    ff::init_unlocked(lock);
+}
+
+/**
+ * Destructor of the pool. It deletes the tasks in the pool (the other ones must have been released).
+ */
+TaskPool::~TaskPool(){
+    Task* t;
+    while(returned.pop((void**)&t))
+        delete t;
+}
+
+/**
+ * Returns an empty task (called by the reader).
+ * \return The task.
+ */
+Task* TaskPool::get(){
+    Task* t;
+    if(returned.pop((void**)&t)){
+        t->reset();
+        return t;
+    }
+    t=new Task(numWorkers,rawSlices);
+    t->pool=this;
+    return t;
+}
+
+/**
+ * Returns a task to the pool (called by the exporters). If the pool is full the task is deleted.
+ * \param t The task.
+ */
+void TaskPool::put(Task* t){
+    ff::spin_lock(lock);
+    bool pushed=returned.push(t);
+    ff::spin_unlock(lock);
+    if(!pushed)
+        delete t;
+}
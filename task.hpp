@@ -30,9 +30,38 @@
 #ifndef TASK_HPP_
 #define TASK_HPP_
 #include "flow.hpp"
-#include <ff/squeue.hpp>
+#include <ff/buffer.hpp>
+#include <ff/spin-lock.hpp>
 #include <iostream>
 
+/**
+ * Number of bytes of a packet copied by the reader when the packets are parsed by the workers (so that a
+ * rawPacket fills two cache lines).
+ */
+#define RAW_SLICE 112
+
+/**
+ * Initial number of packets that a task can contain for each worker (when the packets are parsed by the workers).
+ */
+#define TASK_RAW_CAPACITY 64
+
+/**
+ * Number of tasks that can wait to be reused in a TaskPool.
+ */
+#define TASK_POOL_SIZE 512
+
+class TaskPool;
+
+/**
+ * The first bytes of a packet that will be parsed by a worker.
+ */
+struct rawPacket {
+    time_t timestamp; ///<The time at which the packet has been captured.
+    uint32_t caplen;  ///<Number of bytes of the packet contained in data.
+    uint32_t len;     ///<Length of the packet on the wire.
+    uint16_t vlanId;  ///<VLAN ID of the tag removed from the packet by the NIC (0 if none).
+    u_char data[RAW_SLICE]; ///<The first bytes of the packet.
+};
 
 /**
  * The task generated by the first stage of the pipeline.
@@ -40,10 +69,13 @@
 class Task{
 private:
     uint numWorkers;    ///<Number of workers of the pipeline.
-    ff::squeue<hashElement>
-        **flowsToAdd,///< A list of flows to add.
-        *flowsToExport;///< A list of flows to export.
+    packetRecords **flowsToAdd; ///< The packets of each worker.
+    flowQueue *flowsToExport; ///< A list of flows to export.///< A list of flows to export.
+    rawPacket **packetsToParse; ///< The packets to parse for each worker (NULL if the reader parses the packets).
+    uint *numPacketsToParse, ///< Number of packets to parse for each worker.
+         *capacities; ///< Capacities of packetsToParse.
     bool eof; ///< True if the eof of a .pcap file is arrived.
+    TaskPool *pool; ///< The pool to which the task is returned when it has been exported (NULL if it is deleted).
         /**
       * The timestamp will be taken per task instead of per packet.
       * In this way we avoid the overhead due to an huge number of call of "time(NULL)".
@@ -56,14 +88,25 @@ public:
     /**
      * Constructor of the task.
      * \param numWorkers Number of workers of the pipeline.
+     * \param rawSlices True if the packets are parsed by the workers instead of by the reader.
      */
-    Task(uint numWorkers);
+    Task(uint numWorkers, bool rawSlices=false);
 
     /**
      * Denstructor of the task.
      */
     ~Task();
 
+    /**
+     * Empties the task, so that it can be reused.
+     */
+    void reset();
+
+    /**
+     * Called when the flows of the task have been exported: returns the task to its pool or deletes it.
+     */
+    void release();
+
     /**
       * Sets the timestamp of the task.
       * \param t The timestamp.
@@ -86,21 +129,56 @@ public:
      * Returns a pointer to the list of flows to export.
      * \return A pointer to the list of flows to export.
      */
-    ff::squeue<hashElement>* getFlowsToExport();
+    flowQueue* getFlowsToExport();
 
     /**
-     * Returns a pointer to the list of the flows to add.
-     * \return A pointer to the list of the flows to add.
+     * Returns a pointer to the packets of the i-th worker.
+     * \return A pointer to the packets of the i-th worker.
      */
-    ff::squeue<hashElement>* getFlowsToAdd(const int i);
+    packetRecords* getFlowsToAdd(const int i);
 
     /**
-     * Adds the hashElement h for the i-th worker.
-     * \param h The hashElement to add.
+     * Adds the packet whose flow is h for the i-th worker.
+     * \param h The flow of the packet (First is the capture time and dOctets the length).
      * \param i The worker that have to add the flow.
      */
     void setFlowToAdd(hashElement& h, const int i);
 
+    /**
+     * Copies the first RAW_SLICE bytes of a packet, that will be parsed by the i-th worker.
+     * \param data The packet.
+     * \param caplen Number of bytes of the packet that have been captured.
+     * \param len Length of the packet on the wire.
+     * \param timestamp The time at which the packet has been captured.
+     * \param vlanId VLAN ID of the tag removed from the packet by the NIC (0 if none).
+     * \param i The worker that have to parse the packet.
+     */
+    inline void setPacketToParse(const u_char* data, uint32_t caplen, uint32_t len, time_t timestamp, uint16_t vlanId, const int i){
+        if(numPacketsToParse[i]==capacities[i]){
+            capacities[i]*=2;
+            rawPacket* p=(rawPacket*)realloc(packetsToParse[i],capacities[i]*sizeof(rawPacket));
+            if(p==NULL){
+                fprintf(stderr, "Impossible to allocate the packets to parse.\n");
+                exit(-1);
+            }
+            packetsToParse[i]=p;
+        }
+        rawPacket& r=packetsToParse[i][numPacketsToParse[i]++];
+        r.timestamp=timestamp;
+        r.caplen=caplen<RAW_SLICE?caplen:RAW_SLICE;
+        r.len=len;
+        r.vlanId=vlanId;
+        memcpy(r.data,data,r.caplen);
+    }
+
+    /**
+     * Returns the packets that must be parsed by the i-th worker.
+     * \param i The worker.
+     * \param n It will contain the number of packets.
+     * \return The packets (NULL if the reader parses the packets).
+     */
+    rawPacket* getPacketsToParse(const int i, uint* n);
+
     /**Sets EOF. **/
     void setEof();
 
@@ -118,6 +196,45 @@ public:
      * \return The number of workers.
      */
     int getNumWorkers();
+
+    friend class TaskPool;
+};
+
+/**
+ * Tasks of a reader that are reused. The tasks exported by the last stage are returned to the reader with a
+ * lock-free single producer/single consumer queue, so after the first tasks the reader doesn't allocate
+ * memory for them. When there is more than one exporter their returns are serialized by a spin lock.
+ */
+class TaskPool{
+private:
+    uint numWorkers; ///< Number of workers of the pipeline.
+    bool rawSlices; ///< True if the packets are parsed by the workers.
+    ff::SWSR_Ptr_Buffer returned; ///< The tasks returned by the last stage.
+    ff::lock_t lock; ///< Serializes the exporters that return the tasks.
+public:
+    /**
+     * Constructor of the pool.
+     * \param numWorkers Number of workers of the pipeline.
+     * \param rawSlices True if the packets are parsed by the workers instead of by the reader.
+     */
+    TaskPool(uint numWorkers, bool rawSlices);
+
+    /**
+     * Destructor of the pool. It deletes the tasks in the pool (the other ones must have been released).
+     */
+    ~TaskPool();
+
+    /**
+     * Returns an empty task (called by the reader).
+     * \return The task.
+     */
+    Task* get();
+
+    /**
+     * Returns a task to the pool (called by the exporters). If the pool is full the task is deleted.
+     * \param t The task.
+     */
+    void put(Task* t);
 };
 
 #endif /* TASK_HPP_ */
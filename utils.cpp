@@ -110,13 +110,13 @@ uint captureCpuInfos(std::vector<uint> &processors_to_use){
 void generateMapping(uint* cores, uint numThreads, uint chip){
     std::vector<uint> processors_to_use;
     uint num_chips=captureCpuInfos(processors_to_use),num_real_cores=processors_to_use.size();
-    uint cores_per_chip=num_real_cores/num_chips;
-    uint starting_processor=chip*cores_per_chip;
     if(num_chips==0){
         for(uint i=0; i<numThreads; i++)
             cores[i]=i;
         std::cerr << "ATTENTION: It's not possible to analyze the /proc/cpuinfo file." << std::endl;
     }else{
+        uint cores_per_chip=num_real_cores/num_chips;
+        uint starting_processor=chip*cores_per_chip;
         for(uint i=0; i<numThreads; i++){
             cores[i]=processors_to_use[(i+starting_processor)%num_real_cores];
         }
@@ -30,13 +30,12 @@
 #ifndef WORKERS_HPP
 #define WORKER_HPP
 #include <deque>
-#include <pcap.h>
 #include <sys/poll.h>
 #include <ff/node.hpp>
 #include <ff/mapping_utils.hpp>
 #include <ff/pipeline.hpp>
+#include <ff/farm.hpp>
 #include <ff/gt.hpp>
-#include <pfring.h>
 #undef min
 #undef max
 #include <queue>
@@ -44,15 +43,53 @@
 #include <errno.h>
 #include "task.hpp"
 #include "hashTable.hpp"
+#include "archive.hpp"
+#include "flowPrinter.hpp"
+#include "flowOutput.hpp"
+#include "packetSource.hpp"
 
+/**
+ * Number of packets requested to the source with a single call (default, minimum and maximum).
+ */
+#define READER_BURST 64
+#define READER_MIN_BURST 32
+#define READER_MAX_BURST 256
+
+/**
+ * How many packets ahead the reader prefetches the headers while it parses a burst.
+ */
+#define PREFETCH_DISTANCE 4
+
+
+/**
+ * Extracts the flow from a packet and computes its position in the hash table.
+ * \param data The packet.
+ * \param caplen Number of bytes of the packet that have been captured.
+ * \param len Length of the packet on the wire.
+ * \param timestamp The time at which the packet has been captured.
+ * \param vlanId VLAN ID of the tag removed from the packet by the NIC (0 if none).
+ * \param f The hashElement that will contain the flow.
+ * \return False if the packet doesn't contain a flow.
+ */
+bool parsePacket(const u_char *data, uint32_t caplen, uint32_t len, time_t timestamp, u_int16_t vlanId, hashElement& f);
+
+/**
+ * Fills a flow with the fields of a packet already parsed by the source (e.g. by the PF_RING
+ * kernel module) and computes its position in the hash table. The packet is not read.
+ * \param pkt The packet.
+ * \param f The hashElement that will contain the flow.
+ */
+void parseMetadata(const packet *pkt, hashElement& f);
 
 /**
- * The function called by pcap_dispatch when a packet arrive.
- * \param user A param passed by the worker.
- * \param phdr The header of the packet.
- * \param pdata The packet.
+ * Chooses the worker that will parse a packet, reading only its IP addresses (used when the packets
+ * are parsed by the workers). All the packets of a flow are given to the same worker.
+ * \param data The packet.
+ * \param caplen Number of bytes of the packet that have been captured.
+ * \param nWorkers Number of workers.
+ * \return The worker.
  */
-void dispatchCallback(const struct pfring_pkthdr *phdr, const u_char *pdata , const u_char *user_bytes);
+uint selectWorker(const u_char *data, uint32_t caplen, uint nWorkers);
 
 /**
  * Signal handler for SIGINT.
@@ -66,28 +103,54 @@ void handler(int i);
 class firstStage: public ff::ff_node{
 private:
     uint maxP, ///< Maximum number of packet to read from the device (or from the .pcap file)
+         burst, ///< Number of packets requested to the source with a single call.
          nWorkers, ///< Number of workers
          id, ///< Identifier of the reader
          core; ///<The id of the core on which this thread should be mapped.
     bool offline, ///< True if the device is a .pcap file
+         rawSlices, ///< True if the packets are parsed by the workers.
+         kernelParsing, ///< True if the fields parsed by the source are used.
          end; ///< When end is true this node must return FF_EOS.
-    pfring *private_handle;
+    PacketSource *source; ///< The source of the packets.
+    packet *pkts; ///< The last burst of packets received from the source.
+    hashElement *flows; ///< The flows extracted from the last burst.
+    bool *valid; ///< valid[i] is true if the i-th packet of the last burst contains a flow.
+    TaskPool *pool; ///< The tasks of this reader.
+    ff::ff_loadbalancer *lb; ///< The load balancer of the farm (NULL if the workers are stages of a pipeline).
+    Task **tasks; ///< The tasks being filled (one for each worker if the workers are in a farm).
 #ifdef COMPUTE_STATS
     unsigned long invocations,total_time;
     float avg_latency;
 #endif
+
+    /**
+     * Returns the task that contains the packets of a worker.
+     * \param w The worker.
+     */
+    inline Task* taskOf(uint w){return tasks[lb!=NULL?w:0];}
+
+    /**
+     * Returns the position of a worker in its task.
+     * \param w The worker.
+     */
+    inline uint slotOf(uint w){return lb!=NULL?0:w;}
 public:
     /**
      * Constructor of the first stage.
      * \param nw Number of workers.
-     * \param device Name of the device (or of the .pcap file)
+     * \param device Name of the device (or of the .pcap/.pcapng file).
+     * \param sourceType The type of the source of the packets (see createPacketSource).
      * \param promisc 1 if the interface must be set in promiscous mode, 0 otherwise.
      * \param cnt Maximum number of packet to read from the device (or from the .pcap file).
-     * \param h Size of the hash table (Sizeof(HashOfWorker1)+Sizeof(HashOfWorker2)+...+Sizeof(HashOfWorkerN)).
+     * \param burst Number of packets requested to the source with a single call.
+     * \param rawSlices If true the reader only copies the first bytes of the packets and the workers parse them.
+     * \param kernelParsing If true the fields parsed by the source are used (when available) instead of parsing the packets.
      * \param id The identifier of the reader.
      * \param core The id of the core on which this thread should be mapped.
+     * \param lb If not NULL, the reader is the emitter of a farm and sends a task to each worker through lb.
      */
-    firstStage(int nw, char* device, uint promisc, int cnt, int h, uint id, uint core);
+    firstStage(int nw, char* device, const char* sourceType, uint promisc, int cnt, uint burst, bool rawSlices, bool kernelParsing,
+               uint id, uint core, ff::ff_loadbalancer* lb=NULL);
 
     /**
      * Destructor of the first stage.
@@ -118,7 +181,8 @@ class genericStage:public ff::ff_node{
 private:
     uint id,hs,core; ///<The id of the core on which this thread should be mapped.
     int flowsPerTaskCheck;
-    Hash* h;
+    FlowTable* h;
+    ff::FFBUFFER* outBuffer; ///< If not NULL the tasks are sent to an exporter through this buffer.
 #ifdef COMPUTE_STATS
         unsigned long invocations,total_time;
         float avg_latency;
@@ -129,12 +193,20 @@ public:
      * \param id The id of this worker.
      * \param hSize The size of this part of hash table.
      * \param maxActiveFlows Max number of active flows.
+     * \param evictFlows Number of flows evicted when the table has maxActiveFlows flows.
      * \param idle Max number of seconds of inactivity (max 24h). (Default is 30).
      * \param lifeTime Max number of life's seconds of a flow (max 24h). (Default is 120).
      * \param flowsPerTaskCheck Number of flows to check when a worker receives a task (-1 is all), default is 1.
+     * \param tableType The type of the table of flows (see createFlowTable).
      * \param core The id of the core on which this thread should be mapped.
      */
-    genericStage(uint id, uint hSize, uint maxActiveFlows, uint idle, uint lifeTime, int flowsPerTaskCheck, uint core);
+    genericStage(uint id, uint hSize, uint maxActiveFlows, uint evictFlows, uint idle, uint lifeTime, int flowsPerTaskCheck, const char* tableType, uint core);
+
+    /**
+     * Sends the tasks (and the end of stream) to an exporter through a buffer instead of returning them.
+     * \param b The buffer read by the exporter.
+     */
+    void setOutputBuffer(ff::FFBUFFER* b);
 
     /**
      * Destructor of the stage.
@@ -150,6 +222,8 @@ public:
      */
     void* svc(void* p);
 
+    void eosnotify(ssize_t id=-1);
+
     void svc_end();
 
     float get_avg_latency();
@@ -160,27 +234,30 @@ public:
  */
 class lastStage:public ff::ff_node{
 private:
-    FILE* out; ///<File where to print the flows in textual format.
+    FlowOutput* out; ///<File where to print the flows in textual format (shared by the exporters).
     uint qTimeout, ///<It specifies how long expired flows (queued before delivery) are emitted
-        flowSequence, ///<Sequence number for the flows to export
         minFlowSize,///<Minimum tcp flows size
-        core;///<The id of the core on which this thread should be mapped.
-    std::queue<hashElement>* q; ///<Queue of expired flows
+        core,///<The id of the core on which this thread should be mapped.
+        producers;///<Number of tasks with the eof flag that must arrive before exporting the last flows.
+    FlowArchive* archive;///<The archive where the flows are written (NULL if none).
+    uint archiveProducer;///<The identifier of this stage in the archive.
     time_t lastEmission; ///<Time of the last export
     Exporter ex;
+    FlowPrinter printer; ///<Formats the flows printed on out.
 #ifdef COMPUTE_STATS
         unsigned long invocations,total_time;
         float avg_latency;
 #endif
 
     /**
-     * Exports the flow to the remote collector (also prints it into the file).
+     * Sends to the remote collector all the flows encoded by the exporter and writes the ones formatted
+     * by the printer.
      */
     void exportFlows();
 public:
     /**
      * Constructor of the last stage of the pipeline.
-     * \param out The FILE* where to print exported flows.
+     * \param out The file where to print exported flows (NULL if none).
      * \param queueTimeout It specifies how long expired flows (queued before delivery) are emitted.
      * \param collector The host of the collector.
      * \param port The port where to send the flows.
@@ -188,7 +265,26 @@ public:
      * \param systemStartTime The system start time.
      * \param core The id of the core on which this thread should be mapped.
      */
-    lastStage(FILE* out,uint queueTimeout,const char* collector, uint port, uint minFlowSize, uint32_t systemStartTime, uint core);
+    lastStage(FlowOutput* out,uint queueTimeout,const char* collector, uint port, uint minFlowSize, uint32_t systemStartTime, uint core);
+
+    /**
+     * Sets the number of stages that send a task with the eof flag to this stage (default is 1).
+     * \param n The number of stages (e.g. the workers of a farm).
+     */
+    void setProducers(uint n);
+
+    /**
+     * Sets the identifier of the exporter, used as NetFlow engine (or source) id (default is 0).
+     * \param id The identifier.
+     */
+    void setEngineId(u_int8_t id);
+
+    /**
+     * Writes the exported flows also in a binary archive.
+     * \param a The archive.
+     * \param producer The identifier of this stage in the archive (each exporter must have its own).
+     */
+    void setArchive(FlowArchive* a, uint producer);
 
     /**
      * Destructor of the stage.
@@ -235,7 +331,6 @@ public:
 };
 
 
-#ifdef MULTIPLE_READERS
 class CThread{
 public:
    CThread();
@@ -257,8 +352,7 @@ private:
    pthread_t _thread;
 };
 
-
-
+#ifdef MULTIPLE_READERS
 class readerThread: public CThread{
 private:
     ff::FFBUFFER* outbuffer;
@@ -275,10 +369,15 @@ public:
 
     void stats(std::ostream & out);
 
-    inline float get_avg_latency();
+    float get_avg_latency();
 
 };
+#endif
 
+/**
+ * A thread that receives the tasks from more buffers and gives them to a node. It ends when it has
+ * received the end of stream from all the buffers.
+ */
 class gatherThread: public CThread{
 private:
     ff::FFBUFFER **inbuffers,*outbuffer;
@@ -295,6 +394,7 @@ public:
     void stats(std::ostream & out);
 };
 
+#ifdef MULTIPLE_READERS
 /**This is created only to have the 'create_input_buffer' method public.**/
 class my_pipeline: public ff::ff_pipeline{
 public: